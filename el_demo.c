@@ -18,6 +18,7 @@ void print_ptr(char *str, void *ptr){
 int main(){
   printf("EL_BLOCK_OVERHEAD: %lu\n",EL_BLOCK_OVERHEAD);
   el_init();
+  el_ctl->grow_factor = 0;      // disable automatic growth to show el_append_pages_to_heap()
 
   printf("INITIAL\n"); el_print_stats(); printf("\n");
 
@@ -71,7 +72,7 @@ int main(){
 
   printf("FREE'D 2\n"); el_print_stats(); printf("\n");
 
-  p1 = el_malloc(3438);
+  p1 = el_malloc(3400);
   p2 = el_malloc(1024);
   printf("P2 FAILS\n");
   printf("POINTERS\n");
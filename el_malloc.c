@@ -1,46 +1,150 @@
-
-
 // el_malloc.c: implementation of explicit list malloc functions.
 
+#define _GNU_SOURCE                     // for mremap()
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <time.h>
 #include "el_malloc.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // Global control functions
 
 // Global control variable for the allocator. Must be initialized in
-// el_init().
+// el_init(). When built with EL_THREADSAFE each thread has its own
+// el_ctl which points at the arena it is working on.
+#ifdef EL_THREADSAFE
+__thread el_ctl_t *el_ctl = NULL;
+static __thread el_ctl_t *el_home = NULL; // arena the thread allocates from
+static int el_next_arena = 0;             // round-robin arena for the next new thread
+static int el_generation = 0;             // bumped each time the arenas are created or destroyed
+#else
 el_ctl_t *el_ctl = NULL;
+#endif
+
+// State of the allocation trace being recorded by el_trace_begin().
+// Pointers are mapped to their trace IDs by an open addressed table
+// kept with the system malloc() so that tracing leaves the heap being
+// traced undisturbed.
+typedef struct {
+  FILE *file;                   // trace being written; NULL when not tracing
+  void **ptrs;                  // pointers allocated during the trace, NULL in empty slots
+  uint32_t *ids;                // ID of the pointer in the same slot of ptrs
+  size_t slots;                 // size of the table, a power of two
+  size_t live;                  // pointers in the table
+  uint32_t next_id;             // ID given to the next pointer allocated
+  uint64_t beg_nsecs;           // time the trace began
+#ifdef EL_THREADSAFE
+  pthread_mutex_t lock;         // held while the trace is written
+#endif
+} el_trace_t;
+
+static el_trace_t el_trace = {
+#ifdef EL_THREADSAFE
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+static int el_extend_heap(size_t new_size);
+static void el_free_unlocked(void *ptr);
+static el_blockhead_t *el_coalesce(el_blockhead_t *block);
+static uint32_t el_trace_forget(void *ptr);
+static void el_trace_restore(void *ptr, uint32_t id);
+static void el_trace_record(int op, uint32_t id, void *ptr, size_t size, size_t align);
+#ifdef EL_THREADSAFE
+static void el_tcache_reset();
+#endif
+static void el_unmap_ctl(el_ctl_t *ctl);
+
+// Initialize the allocator with the default first-fit policy over a
+// single available list.
+int el_init(){
+  return el_init_flags(0);
+}
+
+// Create the heap with el_init_arena() at EL_CTL_START_ADDRESS and
+// EL_HEAP_START_ADDRESS. When built with EL_THREADSAFE, creates
+// EL_ARENA_COUNT arenas with their own control, heap, and lock
+// instead; the calling thread is given the first arena and later
+// threads are given arenas round-robin on their first call. If the
+// environment variable EL_TRACE names a file, a trace of the heap is
+// recorded there with el_trace_begin() until el_cleanup().
+int el_init_flags(int flags){
+#ifdef EL_THREADSAFE
+  for(int i=0; i<EL_ARENA_COUNT; i++){
+    if(el_init_arena(el_arena(i), PTR_PLUS_BYTES(EL_HEAP_START_ADDRESS, i*EL_ARENA_SPAN), flags) != 0){
+      while(i > 0){                       // unmap the arenas already made
+        el_unmap_ctl(el_arena(--i));
+      }
+      el_home = el_ctl = NULL;
+      return 1;
+    }
+    pthread_mutex_init(&el_ctl->lock, NULL);
+  }
+  el_home = el_ctl = el_arena(0);
+  __atomic_store_n(&el_next_arena, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&el_generation, 1, __ATOMIC_RELAXED);
+  el_tcache_reset();
+#else
+  if(el_init_arena(EL_CTL_START_ADDRESS, EL_HEAP_START_ADDRESS, flags) != 0){
+    return 1;
+  }
+#endif
+  char *trace_path = getenv("EL_TRACE");
+  if(trace_path != NULL){
+    el_trace_begin(trace_path);
+  }
+  return 0;
+}
 
 // Create an initial block of memory for the heap using
-// mmap(). Initialize the el_ctl data structure to point at this
-// block. The initializ size/position of the heap for the memory map
-// are given in the symbols EL_HEAP_INITIAL_SIZE and
-// EL_HEAP_START_ADDRESS.  Initialize the lists in el_ctl to contain a
-// single large block of available memory and no used blocks of
-// memory.
-int el_init(){
+// mmap(). The control structure is mapped at ctl_addr and the heap at
+// heap_addr with the initial size given in EL_HEAP_INITIAL_SIZE; both
+// use MAP_FIXED_NOREPLACE so that nothing already mapped there is
+// disturbed. Prints an error and returns 1 if either address is
+// taken. Otherwise initializes el_ctl with el_init_ctl().
+int el_init_arena(void *ctl_addr, void *heap_addr, int flags){
   el_ctl =
-    mmap(EL_CTL_START_ADDRESS,
-         EL_PAGE_BYTES,
+    mmap(ctl_addr,
+         EL_CTL_BYTES,
          PROT_READ | PROT_WRITE,
-         MAP_PRIVATE | MAP_ANONYMOUS,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
          -1, 0);
-  assert(el_ctl == EL_CTL_START_ADDRESS);
+  if(el_ctl != ctl_addr){
+    fprintf(stderr,"el_init: unable to map control at %p\n",ctl_addr);
+    return 1;
+  }
 
   void *heap = 
-    mmap(EL_HEAP_START_ADDRESS,
+    mmap(heap_addr,
          EL_HEAP_INITIAL_SIZE,
          PROT_READ | PROT_WRITE,
-         MAP_PRIVATE | MAP_ANONYMOUS,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE,
          -1, 0);
-  assert(heap == EL_HEAP_START_ADDRESS);
+  if(heap != heap_addr){
+    fprintf(stderr,"el_init: unable to map heap at %p\n",heap_addr);
+    munmap(el_ctl, EL_CTL_BYTES);
+    return 1;
+  }
+
+  return el_init_ctl(heap, EL_HEAP_INITIAL_SIZE, NULL, flags);
+}
 
-  el_ctl->heap_bytes = EL_HEAP_INITIAL_SIZE; // make the heap as big as possible to begin with
+// Initialize the el_ctl data structure for a heap of heap_bytes
+// mapped at heap. heap_limit is the end of address space reserved for
+// the heap to grow into or NULL if growth relies on mmap() placing
+// pages at the end of the heap. Initialize the lists in el_ctl to
+// contain a single large block of available memory and no used blocks
+// of memory. The flags select allocation policies such as
+// EL_SEGREGATED, EL_BEST_FIT, EL_ADDRESS_ORDER, EL_NEXT_FIT or
+// EL_DEFERRED or the EL_BUDDY engine and are retained
+// in el_ctl->flags.
+int el_init_ctl(void *heap, size_t heap_bytes, void *heap_limit, int flags){
+  el_ctl->heap_bytes = heap_bytes;           // make the heap as big as possible to begin with
   el_ctl->heap_start = heap;                 // set addresses of start and end of heap
   el_ctl->heap_end   = PTR_PLUS_BYTES(heap,el_ctl->heap_bytes);
+  el_ctl->heap_limit = heap_limit;
 
   if(el_ctl->heap_bytes < EL_BLOCK_OVERHEAD){
     fprintf(stderr,"el_init: heap size %ld to small for a block overhead %ld\n",
@@ -52,44 +156,371 @@ int el_init(){
   el_init_blocklist(&el_ctl->used_actual);
   el_ctl->avail = &el_ctl->avail_actual;
   el_ctl->used  = &el_ctl->used_actual;
+  el_ctl->flags = flags;
+  el_ctl->grow_factor = EL_GROW_FACTOR;
+  el_ctl->grow_count = 0;
+  el_ctl->trim_threshold = EL_TRIM_THRESHOLD;
+  el_ctl->released_bytes = 0;
+  el_ctl->zero_start = heap;
+  el_ctl->mmap_threshold = EL_MMAP_THRESHOLD;
+  el_ctl->mapped = NULL;
+  el_ctl->mapped_count = 0;
+  el_ctl->mapped_bytes = 0;
+#ifdef EL_THREADSAFE
+  el_ctl->tcache_hits = 0;
+  el_ctl->tcache_misses = 0;
+  el_ctl->remote_free = NULL;
+  el_ctl->remote_frees = 0;
+#endif
+  for(int i=0; i<EL_FL_COUNT; i++){
+    for(int j=0; j<EL_SL_COUNT; j++){
+      el_init_blocklist(&el_ctl->bins[i][j]);
+    }
+    el_ctl->sl_bitmap[i] = 0;
+  }
+  el_ctl->fl_bitmap = 0;
+  el_ctl->avail_tree = NULL;
+  el_ctl->rover = NULL;
+  el_ctl->search_count = 0;
+  el_ctl->search_steps = 0;
+  for(int c=0; c<EL_QUICK_CLASSES; c++){
+    el_ctl->quick[c] = NULL;
+  }
+  el_ctl->quick_count = 0;
+  el_ctl->quick_bytes = 0;
+  el_ctl->quick_threshold = EL_QUICK_THRESHOLD;
+  el_ctl->consolidations = 0;
+
+  // the buddy engine divides the heap into blocks of its own sizes
+  if(flags & EL_BUDDY){
+    el_buddy_carve(el_buddy_base(), el_buddy_end());
+    return 0;
+  }
 
   // establish the first available block by filling in size in
   // block/foot and null links in head
-  size_t size = el_ctl->heap_bytes - EL_BLOCK_OVERHEAD;
-  el_blockhead_t *ablock = el_ctl->heap_start;
+  size_t size = el_ctl->heap_bytes - 2*EL_HEAP_PAD - EL_BLOCK_OVERHEAD;
+  el_blockhead_t *ablock = PTR_PLUS_BYTES(el_ctl->heap_start, EL_HEAP_PAD);
+#ifdef EL_COMPACT_HEADERS
+  el_blockhead_t *fence = PTR_MINUS_BYTES(el_ctl->heap_end, EL_HEAP_PAD);
+  fence->size = 0;
+  fence->state = EL_END_BLOCK;
+  ablock->prev_free = 0;
+#endif
   ablock->size = size;
   ablock->state = EL_AVAILABLE;
-  el_blockfoot_t *afoot = el_get_footer(ablock);
-  afoot->size = size;
+  el_write_footer(ablock);
+
+  // The tree of available blocks has no lists to fill in by hand
+  if(flags & (EL_BEST_FIT | EL_ADDRESS_ORDER)){
+    el_add_avail(ablock);
+    return 0;
+  }
 
   // Add initial block to availble list; avoid use of list add
   // functions in case those are buggy which will screw up the heap
   // initialization
-  ablock->prev = el_ctl->avail->beg;
-  ablock->next = el_ctl->avail->beg->next;
+  el_blocklist_t *avail = el_avail_list(ablock->size);
+  ablock->prev = avail->beg;
+  ablock->next = avail->beg->next;
   ablock->prev->next = ablock;
   ablock->next->prev = ablock;
-  el_ctl->avail->length++;
-  el_ctl->avail->bytes += (ablock->size + EL_BLOCK_OVERHEAD);
+  avail->length++;
+  avail->bytes += (ablock->size + EL_BLOCK_OVERHEAD);
+  if(flags & EL_SEGREGATED){
+    int fl, sl;
+    el_bin_index(ablock->size, &fl, &sl);
+    el_ctl->fl_bitmap |= (1UL << fl);
+    el_ctl->sl_bitmap[fl] |= (1U << sl);
+  }
 
   return 0;
 }
 
+// Unmap the heap of ctl, including any address space reserved for it
+// to grow into, and any mappings made for its large blocks, and then
+// ctl itself
+static void el_unmap_ctl(el_ctl_t *ctl){
+#ifdef EL_THREADSAFE
+  pthread_mutex_destroy(&ctl->lock);
+#endif
+  el_map_t *map = ctl->mapped;
+  while(map != NULL){
+    el_map_t *next = map->next;
+    munmap(map, map->bytes);
+    map = next;
+  }
+  if(ctl->heap_limit != NULL){
+    munmap(ctl->heap_start, PTR_MINUS_PTR(ctl->heap_limit, ctl->heap_start));
+  }
+  else{
+    munmap(ctl->heap_start, ctl->heap_bytes);
+  }
+  munmap(ctl, EL_CTL_BYTES);
+}
+
 // Clean up the heap area associated with the system which unmaps all
-// pages associated with the heap.
+// pages associated with the heap, or with every arena when built with
+// EL_THREADSAFE. Any trace being recorded is ended.
 void el_cleanup(){
-  munmap(el_ctl->heap_start, el_ctl->heap_bytes);
-  munmap(el_ctl, EL_PAGE_BYTES);
+  el_trace_end();
+#ifdef EL_THREADSAFE
+  for(int i=0; i<EL_ARENA_COUNT; i++){
+    el_unmap_ctl(el_arena(i));
+  }
+  el_home = el_ctl = NULL;
+  __atomic_add_fetch(&el_generation, 1, __ATOMIC_RELAXED);
+  el_tcache_reset();
+#else
+  el_unmap_ctl(el_ctl);
+#endif
+}
+
+#ifdef EL_THREADSAFE
+// Return the control structure of arena i which lives at a fixed
+// offset from EL_CTL_START_ADDRESS.
+el_ctl_t *el_arena(int i){
+  return PTR_PLUS_BYTES(EL_CTL_START_ADDRESS, i*EL_CTL_BYTES);
+}
+
+// Return the arena owning the block at ptr. Each arena's heap grows
+// within its own EL_ARENA_SPAN bytes so the owner follows from the
+// address; a block in a mapping of its own records its owner there.
+// Prints an error and aborts if ptr belongs to no arena, as does a
+// block of a heap from el_heap_create() which must be given to
+// el_heap_free() instead.
+el_ctl_t *el_arena_of(void *ptr){
+  el_blockhead_t *block = PTR_MINUS_BYTES(ptr, EL_HEAD_BYTES);
+  if(block->state == EL_MAPPED){
+    el_ctl_t *ctl = el_map_of(block)->ctl;
+    if((void *) ctl >= EL_CTL_START_ADDRESS &&
+       PTR_MINUS_PTR(ctl, EL_CTL_START_ADDRESS) / EL_CTL_BYTES < EL_ARENA_COUNT)
+    {
+      return ctl;
+    }
+  }
+  else if(ptr >= EL_HEAP_START_ADDRESS &&
+          PTR_MINUS_PTR(ptr, EL_HEAP_START_ADDRESS) / EL_ARENA_SPAN < EL_ARENA_COUNT)
+  {
+    return el_arena(PTR_MINUS_PTR(ptr, EL_HEAP_START_ADDRESS) / EL_ARENA_SPAN);
+  }
+  fprintf(stderr, "ERROR: %p belongs to no arena; blocks of el_heap_create() heaps go to el_heap_free()\n", ptr);
+  abort();
+}
+
+// Return the arena of the calling thread, giving it one round-robin
+// on its first call
+static el_ctl_t *el_home_arena(){
+  if(el_home == NULL){
+    int i = __atomic_fetch_add(&el_next_arena, 1, __ATOMIC_RELAXED);
+    el_home = el_arena(i % EL_ARENA_COUNT);
+  }
+  return el_home;
+}
+
+// Push a block freed by a thread other than those of its arena onto
+// the arena's remote free stack without locking. The block's first
+// word links the stack. A failed compare-and-swap only means another
+// thread pushed first and is retried. The stack is drained when a
+// thread of the arena next allocates from it; once every such thread
+// has exited, that waits until el_home_arena() gives the arena to a
+// new thread, and until then the blocks on it stay in use.
+static void el_remote_push(el_ctl_t *arena, void *ptr){
+  void *head = __atomic_load_n(&arena->remote_free, __ATOMIC_RELAXED);
+  do{
+    *(void **) ptr = head;
+  } while(!__atomic_compare_exchange_n(&arena->remote_free, &head, ptr, 1,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+// Free every block on the remote free stack of el_ctl which must be
+// locked. The whole stack is detached at once so that other threads
+// can keep pushing while it is freed.
+static void el_remote_drain(){
+  void *ptr = __atomic_exchange_n(&el_ctl->remote_free, NULL, __ATOMIC_ACQUIRE);
+  while(ptr != NULL){
+    void *next = *(void **) ptr;
+    el_free_unlocked(ptr);
+    el_ctl->remote_frees++;
+    ptr = next;
+  }
+}
+#endif
+
+// Lock the arena owning ptr, or the arena of the calling thread if
+// ptr is NULL, and make it el_ctl for the duration of a call. Locking
+// the calling thread's arena also frees blocks other threads have
+// pushed onto its remote free stack. Does nothing unless built with
+// EL_THREADSAFE.
+static void el_lock_arena(void *ptr){
+#ifdef EL_THREADSAFE
+  el_ctl = (ptr == NULL) ? el_home_arena() : el_arena_of(ptr);
+  pthread_mutex_lock(&el_ctl->lock);
+  if(ptr == NULL && __atomic_load_n(&el_ctl->remote_free, __ATOMIC_RELAXED) != NULL){
+    el_remote_drain();
+  }
+#endif
+}
+
+// Unlock the arena locked by el_lock_arena() and return el_ctl to
+// the arena of the calling thread.
+static void el_unlock_arena(){
+#ifdef EL_THREADSAFE
+  pthread_mutex_unlock(&el_ctl->lock);
+  el_ctl = el_home;
+#endif
+}
+
+#ifdef EL_THREADSAFE
+////////////////////////////////////////////////////////////////////////////////
+// Thread cache functions
+//
+// Each thread keeps blocks of its own arena that it frees of the
+// EL_TCACHE_CLASSES smallest block sizes in a cache of its own, up to
+// EL_TCACHE_COUNT per size, and hands them out again without taking
+// any lock. Cached blocks remain in use as far as their arena is
+// concerned; the first word of their usable space links them. A full
+// class is flushed in a batch of half its blocks and the whole cache
+// is flushed when the thread exits. A cache made before the arenas
+// were last created or destroyed is stale and drops its blocks on
+// next use rather than handing them out or freeing them to arenas
+// that no longer hold them. Hit counts reach the arena whenever the
+// thread locks it.
+
+typedef struct {
+  void *head[EL_TCACHE_CLASSES]; // cached blocks of each size class
+  int count[EL_TCACHE_CLASSES];  // number of blocks cached in each class
+  size_t hits;                   // el_malloc() calls served from the cache
+  size_t misses;                 // el_malloc() calls of a cached size that were not
+  int registered;                // nonzero once the exit flush is registered
+  int generation;                // el_generation when the cache was last emptied
+} el_tcache_t;
+
+static __thread el_tcache_t el_tcache;
+static pthread_key_t el_tcache_key;
+static pthread_once_t el_tcache_once = PTHREAD_ONCE_INIT;
+
+// Return the cache class for blocks of the given size or -1 if blocks
+// of that size are not cached. Block sizes step by EL_ALIGNMENT from
+// that of the smallest block.
+static int el_tcache_class(size_t size){
+  size_t min = el_round_size(0);
+  if(size < min || (size - min) / EL_ALIGNMENT >= EL_TCACHE_CLASSES){
+    return -1;
+  }
+  return (size - min) / EL_ALIGNMENT;
+}
+
+// Add the hit counts of the cache to el_ctl, which must be the locked
+// arena of the thread, and start them again from zero
+static void el_tcache_tally(){
+  el_ctl->tcache_hits += el_tcache.hits;
+  el_ctl->tcache_misses += el_tcache.misses;
+  el_tcache.hits = el_tcache.misses = 0;
+}
+
+// Free up to n blocks from cache class c to the arena of the thread
+// under a single lock
+static void el_tcache_flush(int c, int n){
+  el_lock_arena(NULL);
+  el_tcache_tally();
+  for(int i=0; i<n && el_tcache.head[c] != NULL; i++){
+    void *ptr = el_tcache.head[c];
+    el_tcache.head[c] = *(void **) ptr;
+    el_tcache.count[c]--;
+    el_free_unlocked(ptr);
+  }
+  el_unlock_arena();
+}
+
+// Flush every cached block of the exiting thread and add its hit
+// counts to its arena. A stale cache has nothing to give back.
+static void el_tcache_exit(void *arg){
+  if(el_tcache.generation != __atomic_load_n(&el_generation, __ATOMIC_RELAXED)){
+    return;
+  }
+  for(int c=0; c<EL_TCACHE_CLASSES; c++){
+    el_tcache_flush(c, el_tcache.count[c]);
+  }
+  el_lock_arena(NULL);
+  el_tcache_tally();
+  el_unlock_arena();
+}
+
+static void el_tcache_init(){
+  pthread_key_create(&el_tcache_key, el_tcache_exit);
+}
+
+// Empty the cache of the calling thread without freeing its blocks,
+// for use when the arenas are created or destroyed or the cache is
+// found to be stale
+static void el_tcache_reset(){
+  int registered = el_tcache.registered;
+  memset(&el_tcache, 0, sizeof(el_tcache));
+  el_tcache.registered = registered;
+  el_tcache.generation = __atomic_load_n(&el_generation, __ATOMIC_RELAXED);
+}
+
+// Empty the cache of the calling thread if it is stale
+static void el_tcache_check(){
+  if(el_tcache.generation != __atomic_load_n(&el_generation, __ATOMIC_RELAXED)){
+    el_tcache_reset();
+  }
+}
+
+// Return a cached block for a request of nbytes or NULL if there is
+// none.
+static void *el_tcache_get(size_t nbytes){
+  el_tcache_check();
+  int c = el_tcache_class(el_round_size(nbytes));
+  if(c < 0){
+    return NULL;
+  }
+  void *ptr = el_tcache.head[c];
+  if(ptr == NULL){
+    el_tcache.misses++;
+    return NULL;
+  }
+  el_tcache.head[c] = *(void **) ptr;
+  el_tcache.count[c]--;
+  el_tcache.hits++;
+  return ptr;
+}
+
+// Cache the block at ptr, flushing half of its class first if that
+// is full. Returns 0 if blocks of its size are not cached.
+static int el_tcache_put(void *ptr){
+  el_blockhead_t *block = PTR_MINUS_BYTES(ptr, EL_HEAD_BYTES);
+  int c = el_tcache_class(block->size);
+  if(c < 0){
+    return 0;
+  }
+  el_tcache_check();
+  if(!el_tcache.registered){
+    pthread_once(&el_tcache_once, el_tcache_init);
+    pthread_setspecific(el_tcache_key, &el_tcache);
+    el_tcache.registered = 1;
+  }
+  if(el_tcache.count[c] == EL_TCACHE_COUNT){
+    el_tcache_flush(c, EL_TCACHE_COUNT/2);
+  }
+  *(void **) ptr = el_tcache.head[c];
+  el_tcache.head[c] = ptr;
+  el_tcache.count[c]++;
+  return 1;
 }
+#endif
 
 ////////////////////////////////////////////////////////////////////////////////
 // Pointer arithmetic functions to access adjacent headers/footers
 
 // Compute the address of the foot for the given head which is at a
-// higher address than the head.
+// higher address than the head. With EL_COMPACT_HEADERS only
+// available blocks have a footer at this address.
 el_blockfoot_t *el_get_footer(el_blockhead_t *head){
   size_t size = head->size;
-  el_blockfoot_t *foot = PTR_PLUS_BYTES(head, sizeof(el_blockhead_t) + size);
+  el_blockfoot_t *foot =
+    PTR_PLUS_BYTES(head, EL_BLOCK_OVERHEAD + size - sizeof(el_blockfoot_t));
   return foot;
 }
 
@@ -98,19 +529,24 @@ el_blockfoot_t *el_get_footer(el_blockhead_t *head){
 // lower address than the foot.
 el_blockhead_t *el_get_header(el_blockfoot_t *foot){
   size_t size = foot->size;
-  el_blockhead_t *head = PTR_MINUS_BYTES(foot, sizeof(el_blockhead_t) + size);
+  el_blockhead_t *head =
+    PTR_MINUS_BYTES(foot, EL_BLOCK_OVERHEAD + size - sizeof(el_blockfoot_t));
   return head;
 }
 
 // Return a pointer to the block that is one block higher in memory
 // from the given block.  This should be the size of the block plus
 // the EL_BLOCK_OVERHEAD which is the space occupied by the header and
-// footer. Returns NULL if the block above would be off the heap.
-// DOES NOT follow next pointer, looks in adjacent memory.
+// footer. Returns NULL if the block above would be off the heap, or
+// past the last block of the buddy engine which may leave a few bytes
+// at the end of the heap unused. DOES NOT follow next pointer, looks
+// in adjacent memory.
 el_blockhead_t *el_block_above(el_blockhead_t *block){
   el_blockhead_t *higher =
     PTR_PLUS_BYTES(block, block->size + EL_BLOCK_OVERHEAD);
-  if((void *) higher >= (void*) el_ctl->heap_end){
+  void *end = (el_ctl->flags & EL_BUDDY) ? el_buddy_end() :
+    PTR_MINUS_BYTES(el_ctl->heap_end, EL_HEAP_PAD);
+  if((void *) higher >= end){
     return NULL;
   }
   else{
@@ -126,7 +562,15 @@ el_blockhead_t *el_block_above(el_blockhead_t *block){
 // 
 // WARNING: This function must perform slightly different arithmetic
 // than el_block_above(). Take care when implementing it.
+//
+// With EL_COMPACT_HEADERS only available blocks have a footer so NULL
+// is also returned if the block below is in use.
 el_blockhead_t *el_block_below(el_blockhead_t *block){
+#ifdef EL_COMPACT_HEADERS
+  // Only an available block below has a footer to find it with
+  if (!block->prev_free) return NULL;
+#endif
+
   // Get the spot in memory where the foot of the preceding block should be
   el_blockfoot_t *foot = PTR_MINUS_BYTES(block,sizeof(el_blockfoot_t));
 
@@ -140,6 +584,39 @@ el_blockhead_t *el_block_below(el_blockhead_t *block){
  }
 }
 
+// Return the block at the top of the heap if it is available and NULL
+// if it is in use.
+el_blockhead_t *el_top_avail(){
+#ifdef EL_COMPACT_HEADERS
+  return el_block_below(PTR_MINUS_BYTES(el_ctl->heap_end, EL_HEAP_PAD));
+#else
+  el_blockhead_t *top =
+    el_get_header(PTR_MINUS_BYTES(el_ctl->heap_end, sizeof(el_blockfoot_t)));
+  return top->state == EL_AVAILABLE ? top : NULL;
+#endif
+}
+
+// Return the mapping holding a block with state EL_MAPPED
+el_map_t *el_map_of(el_blockhead_t *block){
+  return PTR_MINUS_BYTES(block, EL_MAP_OFFSET - EL_HEAD_BYTES);
+}
+
+// Bring the footer of a block up to date after its size or state
+// changes. With EL_COMPACT_HEADERS the footer is only written for an
+// available block, as the space belongs to the user otherwise, and
+// the prev_free flag of the header above, which may be the fence at
+// the end of the heap, records the state of the block.
+void el_write_footer(el_blockhead_t *block){
+#ifdef EL_COMPACT_HEADERS
+  el_blockhead_t *above = PTR_PLUS_BYTES(block, block->size + EL_BLOCK_OVERHEAD);
+  above->prev_free = (block->state == EL_AVAILABLE);
+  if(block->state != EL_AVAILABLE){
+    return;
+  }
+#endif
+  el_get_footer(block)->size = block->size;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Block list operations
 
@@ -158,23 +635,59 @@ void el_print_blocklist(el_blocklist_t *list){
     printf("  ");
     block = block->next;
     printf("[%3d] head @ %p ", i, block);
-    printf("{state: %c  size: %5lu}\n", block->state,block->size);
+    printf("{state: %c  size: %5lu}\n", block->state,(size_t) block->size);
   }
 }
 
 
-// Print a single block during a sequential walk through the heap
+// Print a single block during a sequential walk through the heap.
+// With EL_COMPACT_HEADERS the links and footer of used blocks are
+// user data and are not shown; with EL_NO_USED_LIST the links left in
+// used blocks from when they were available are not shown.
 void el_print_block(el_blockhead_t *block){
   el_blockfoot_t *foot = el_get_footer(block);
   printf("%p\n", block);
   printf("  state:      %c\n", block->state);
-  printf("  size:       %lu (total: 0x%lx)\n", block->size, block->size+EL_BLOCK_OVERHEAD);
-  printf("  prev:       %p\n", block->prev);
-  printf("  next:       %p\n", block->next);
-  printf("  user:       %p\n", PTR_PLUS_BYTES(block,sizeof(el_blockhead_t)));
+  printf("  size:       %lu (total: 0x%lx)\n", (size_t) block->size, block->size+EL_BLOCK_OVERHEAD);
+#ifdef EL_COMPACT_HEADERS
+  printf("  prev_free:  %d\n", block->prev_free);
+  if(block->state != EL_AVAILABLE){
+    printf("  user:       %p\n", PTR_PLUS_BYTES(block,EL_HEAD_BYTES));
+    return;
+  }
+#endif
+  int linked = 1;
+#ifdef EL_NO_USED_LIST
+  linked = block->state != EL_USED;
+#endif
+  if(linked){
+    printf("  prev:       %p\n", block->prev);
+    printf("  next:       %p\n", block->next);
+  }
+  printf("  user:       %p\n", PTR_PLUS_BYTES(block,EL_HEAD_BYTES));
   printf("  foot:       %p\n", foot);
-  printf("  foot->size: %lu\n", foot->size);
+  printf("  foot->size: %lu\n", (size_t) foot->size);
+}
+
+#ifdef EL_NO_USED_LIST
+// Print the used blocks in the format of el_print_blocklist(). Used
+// blocks are not linked with EL_NO_USED_LIST so they are found by a
+// walk through the heap and appear in address order.
+void el_print_used(){
+  el_blocklist_t *list = el_ctl->used;
+  printf("{length: %3lu  bytes: %5lu}\n", list->length,list->bytes);
+  int i = 0;
+  el_blockhead_t *block = PTR_PLUS_BYTES(el_ctl->heap_start, EL_HEAP_PAD);
+  while(block != NULL){
+    if(block->state == EL_USED){
+      printf("  [%3d] head @ %p ", i, block);
+      printf("{state: %c  size: %5lu}\n", block->state,(size_t) block->size);
+      i++;
+    }
+    block = el_block_above(block);
+  }
 }
+#endif
 
 // Print out stats on the heap for use in debugging. Shows the
 // available and used list along with a linear walk through the heap
@@ -184,13 +697,71 @@ void el_print_stats(){
   printf("heap_start:  %p\n",el_ctl->heap_start); 
   printf("heap_end:    %p\n",el_ctl->heap_end); 
   printf("total_bytes: %lu\n",el_ctl->heap_bytes);
-  printf("AVAILABLE LIST: ");
-  el_print_blocklist(el_ctl->avail);
+  if(el_ctl->released_bytes > 0){
+    printf("released_bytes: %lu\n",el_ctl->released_bytes);
+  }
+  if(el_ctl->mapped_count > 0){
+    printf("mapped: {length: %lu  bytes: %lu}\n",el_ctl->mapped_count,el_ctl->mapped_bytes);
+  }
+  if(el_ctl->flags & EL_DEFERRED){
+    printf("quick: {count: %lu  bytes: %lu  threshold: %lu  consolidations: %lu}\n",
+           el_ctl->quick_count,el_ctl->quick_bytes,el_ctl->quick_threshold,el_ctl->consolidations);
+  }
+#ifdef EL_THREADSAFE
+  size_t hits = el_ctl->tcache_hits, misses = el_ctl->tcache_misses;
+  if(el_ctl == el_home){
+    hits += el_tcache.hits;                 // not yet added to the arena
+    misses += el_tcache.misses;
+  }
+  printf("tcache: {hits: %lu  misses: %lu  hit rate: %.1f%%}\n", hits, misses,
+         hits+misses > 0 ? 100.0*hits/(hits+misses) : 0.0);
+  printf("remote_frees: %lu\n", el_ctl->remote_frees);
+#endif
+  if(el_ctl->flags & EL_BUDDY){
+    printf("AVAILABLE ORDERS: {fl_bitmap: 0x%lx}\n",el_ctl->fl_bitmap);
+    for(int k=0; k<EL_FL_COUNT; k++){
+      if(el_ctl->bins[k][0].length > 0){
+        printf("ORDER %2d: ",k);
+        el_print_blocklist(&el_ctl->bins[k][0]);
+      }
+    }
+  }
+  else if(el_ctl->flags & (EL_BEST_FIT | EL_ADDRESS_ORDER)){
+    printf("AVAILABLE TREE: ");
+    el_print_tree();
+  }
+  else if(el_ctl->flags & EL_SEGREGATED){
+    printf("AVAILABLE BINS: {fl_bitmap: 0x%lx}\n",el_ctl->fl_bitmap);
+    for(int i=0; i<EL_FL_COUNT; i++){
+      for(int j=0; j<EL_SL_COUNT; j++){
+        if(el_ctl->bins[i][j].length > 0){
+          printf("BIN %2d,%d: ",i,j);
+          el_print_blocklist(&el_ctl->bins[i][j]);
+        }
+      }
+    }
+  }
+  else{
+    if(el_ctl->flags & EL_NEXT_FIT){
+      printf("search: {count: %lu  steps: %lu  rover: %p}\n",
+             el_ctl->search_count, el_ctl->search_steps, el_ctl->rover);
+    }
+    printf("AVAILABLE LIST: ");
+    el_print_blocklist(el_ctl->avail);
+  }
   printf("USED LIST: ");
+#ifdef EL_NO_USED_LIST
+  el_print_used();
+#else
   el_print_blocklist(el_ctl->used);
+#endif
+#ifdef EL_COMPACT_HEADERS
+  printf("header_bytes_saved: %lu\n",
+         el_ctl->used->length * (EL_WIDE_OVERHEAD - EL_BLOCK_OVERHEAD));
+#endif
   printf("HEAP BLOCKS:\n");
   int i = 0;
-  el_blockhead_t *cur = el_ctl->heap_start;
+  el_blockhead_t *cur = PTR_PLUS_BYTES(el_ctl->heap_start, EL_HEAP_PAD);
   while(cur != NULL){
     printf("[%3d] @ ",i);
     el_print_block(cur);
@@ -241,8 +812,14 @@ void el_add_block_front(el_blocklist_t *list, el_blockhead_t *block){
 // REQUIRED
 // Unlink block from the list it is in which should be the list
 // parameter.  Updates the length and bytes for that list including
-// the EL_BLOCK_OVERHEAD bytes associated with header/footer.
+// the EL_BLOCK_OVERHEAD bytes associated with header/footer. The
+// next-fit rover moves on to the following block if it pointed at
+// this one, or back to the start of the list if there is none.
 void el_remove_block(el_blocklist_t *list, el_blockhead_t *block){
+  if(block == el_ctl->rover){
+    el_ctl->rover = block->next != list->end ? block->next : NULL;
+  }
+
   // Cut out this node by linking the two neighboring nodes to eachother
   block->next->prev = block->prev;
   block->prev->next = block->next;
@@ -251,20 +828,552 @@ void el_remove_block(el_blocklist_t *list, el_blockhead_t *block){
   list->bytes -= block->size + EL_BLOCK_OVERHEAD;      // Remove the size of the block and it's overhead to the byte-size counter
 }
 
+////////////////////////////////////////////////////////////////////////////////
+// Available block tracking
+
+// Compute the first-level (fl) and second-level (sl) indices of the
+// size-class bin for blocks of the given size. The first level is
+// the position of the highest set bit of size and the second level is
+// the next EL_SL_LOG2 bits below it. Sizes smaller than EL_SL_COUNT
+// go in first-level class 0 with one bin per size; sizes beyond the
+// last class go in the last bin.
+void el_bin_index(size_t size, int *fl, int *sl){
+  if(size < EL_SL_COUNT){
+    *fl = 0;
+    *sl = size;
+    return;
+  }
+  int msb = 63 - __builtin_clzl(size);
+  *fl = msb - EL_SL_LOG2 + 1;
+  *sl = (size >> (msb - EL_SL_LOG2)) - EL_SL_COUNT;
+  if(*fl >= EL_FL_COUNT){
+    *fl = EL_FL_COUNT-1;
+    *sl = EL_SL_COUNT-1;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Tree of available blocks
+//
+// With EL_BEST_FIT available blocks form an AVL tree ordered by size
+// and then address; with EL_ADDRESS_ORDER the tree is ordered by
+// address alone. The next/prev links of each block serve as its
+// left/right children and its height is kept in the header, so the
+// tree needs no memory beyond the blocks themselves. Each block also
+// records the largest size in its subtree, rounded up by
+// el_fit_code(), so that first fit by address can pass over subtrees
+// with nothing big enough. With EL_COMPACT_HEADERS it is kept in the
+// footer of the block.
+
+#define EL_LEFT(block)  ((block)->next)
+#define EL_RIGHT(block) ((block)->prev)
+#define EL_TREE_MAX_HEIGHT 64   // bound on AVL height; far more blocks than fit in memory
+#ifndef EL_COMPACT_HEADERS
+#define EL_FIT(block) ((block)->fit)
+#define EL_FIT_MANT 26          // mantissa bits of the 32-bit fit in the header
+#else
+#define EL_FIT(block) (el_get_footer(block)->fit)
+#define EL_FIT_MANT 14          // mantissa bits of the 20-bit fit in the footer
+#endif
+
+// Return the height of the tree under block which may be NULL
+static int el_tree_height(el_blockhead_t *block){
+  return block == NULL ? 0 : block->height;
+}
+
+// Return 1 if block a orders before block b in the tree
+static int el_tree_before(el_blockhead_t *a, el_blockhead_t *b){
+  if(!(el_ctl->flags & EL_BEST_FIT)){
+    return a < b;
+  }
+  return a->size < b->size || (a->size == b->size && a < b);
+}
+
+// Return the code of size kept as the fit of a block. Sizes below
+// 2^EL_FIT_MANT are their own code; larger ones keep an exponent above
+// the top EL_FIT_MANT bits which are rounded up. Codes order as their
+// sizes do and a subtree holds a block of at least size only if its
+// fit is at least el_fit_code(size).
+static size_t el_fit_code(size_t size){
+  int bits = size == 0 ? 0 : 64 - __builtin_clzl(size);
+  if(bits <= EL_FIT_MANT){
+    return size;
+  }
+  int exp = bits - EL_FIT_MANT;
+  return ((size_t) exp << EL_FIT_MANT) + ((size - 1) >> exp) + 1;
+}
+
+// Return the fit of the tree under block which may be NULL
+static size_t el_tree_fit(el_blockhead_t *block){
+  return block == NULL ? 0 : EL_FIT(block);
+}
+
+// Recompute the height and fit of block from its children
+static void el_tree_update(el_blockhead_t *block){
+  int l = el_tree_height(EL_LEFT(block)), r = el_tree_height(EL_RIGHT(block));
+  block->height = 1 + (l > r ? l : r);
+  size_t fit = el_fit_code(block->size);
+  size_t lf = el_tree_fit(EL_LEFT(block)), rf = el_tree_fit(EL_RIGHT(block));
+  if(lf > fit) fit = lf;
+  if(rf > fit) fit = rf;
+  EL_FIT(block) = fit;
+}
+
+// Rotate the tree under block so that its left child becomes its
+// parent and return that child
+static el_blockhead_t *el_tree_rotate_right(el_blockhead_t *block){
+  el_blockhead_t *left = EL_LEFT(block);
+  EL_LEFT(block) = EL_RIGHT(left);
+  EL_RIGHT(left) = block;
+  el_tree_update(block);
+  el_tree_update(left);
+  return left;
+}
+
+// Rotate the tree under block so that its right child becomes its
+// parent and return that child
+static el_blockhead_t *el_tree_rotate_left(el_blockhead_t *block){
+  el_blockhead_t *right = EL_RIGHT(block);
+  EL_RIGHT(block) = EL_LEFT(right);
+  EL_LEFT(right) = block;
+  el_tree_update(block);
+  el_tree_update(right);
+  return right;
+}
+
+// Restore the AVL balance of the tree under block after one of its
+// subtrees changed height by one and return the new root
+static el_blockhead_t *el_tree_balance(el_blockhead_t *block){
+  el_tree_update(block);
+  int balance = el_tree_height(EL_LEFT(block)) - el_tree_height(EL_RIGHT(block));
+  if(balance > 1){
+    el_blockhead_t *left = EL_LEFT(block);
+    if(el_tree_height(EL_LEFT(left)) < el_tree_height(EL_RIGHT(left))){
+      EL_LEFT(block) = el_tree_rotate_left(left);
+    }
+    return el_tree_rotate_right(block);
+  }
+  if(balance < -1){
+    el_blockhead_t *right = EL_RIGHT(block);
+    if(el_tree_height(EL_RIGHT(right)) < el_tree_height(EL_LEFT(right))){
+      EL_RIGHT(block) = el_tree_rotate_right(right);
+    }
+    return el_tree_rotate_left(block);
+  }
+  return block;
+}
+
+// Insert block into the tree under root and return the new root
+el_blockhead_t *el_tree_insert(el_blockhead_t *root, el_blockhead_t *block){
+  if(root == NULL){
+    EL_LEFT(block) = EL_RIGHT(block) = NULL;
+    el_tree_update(block);
+    return block;
+  }
+  if(el_tree_before(block, root)){
+    EL_LEFT(root) = el_tree_insert(EL_LEFT(root), block);
+  }
+  else{
+    EL_RIGHT(root) = el_tree_insert(EL_RIGHT(root), block);
+  }
+  return el_tree_balance(root);
+}
+
+// Remove the first block of the tree under root, storing it in first,
+// and return the new root
+static el_blockhead_t *el_tree_remove_first(el_blockhead_t *root, el_blockhead_t **first){
+  if(EL_LEFT(root) == NULL){
+    *first = root;
+    return EL_RIGHT(root);
+  }
+  EL_LEFT(root) = el_tree_remove_first(EL_LEFT(root), first);
+  return el_tree_balance(root);
+}
+
+// Remove block, which must be in the tree under root, and return the
+// new root. A block with two children is replaced by the first block
+// of its right subtree.
+el_blockhead_t *el_tree_remove(el_blockhead_t *root, el_blockhead_t *block){
+  if(root == block){
+    if(EL_LEFT(root) == NULL){
+      return EL_RIGHT(root);
+    }
+    if(EL_RIGHT(root) == NULL){
+      return EL_LEFT(root);
+    }
+    el_blockhead_t *next;
+    el_blockhead_t *right = el_tree_remove_first(EL_RIGHT(root), &next);
+    EL_LEFT(next) = EL_LEFT(root);
+    EL_RIGHT(next) = right;
+    return el_tree_balance(next);
+  }
+  if(el_tree_before(block, root)){
+    EL_LEFT(root) = el_tree_remove(EL_LEFT(root), block);
+  }
+  else{
+    EL_RIGHT(root) = el_tree_remove(EL_RIGHT(root), block);
+  }
+  return el_tree_balance(root);
+}
+
+// Return the lowest available block in memory of at least size bytes
+// or NULL if there is none. Visits blocks in address order as the
+// available list does for first fit, keeping the path back up the
+// tree on a stack as blocks have no parent links. Subtrees whose fit
+// is below that of size are skipped. Fits are exact for sizes below
+// 2^EL_FIT_MANT, so only a subtree whose largest block rounds to the
+// same code as size is entered in vain and a search takes O(log n)
+// steps, which are counted in el_ctl.
+static el_blockhead_t *el_tree_find_first(size_t size){
+  el_blockhead_t *stack[EL_TREE_MAX_HEIGHT];
+  int depth = 0;
+  size_t fit = el_fit_code(size);
+  el_blockhead_t *block = el_ctl->avail_tree;
+  el_ctl->search_count++;
+  while(1){
+    while(block != NULL && EL_FIT(block) >= fit){
+      el_ctl->search_steps++;
+      stack[depth++] = block;
+      block = EL_LEFT(block);
+    }
+    if(depth == 0){
+      return NULL;
+    }
+    block = stack[--depth];
+    if(block->size >= size){
+      return block;
+    }
+    block = EL_RIGHT(block);
+  }
+}
+
+// Return the smallest available block of at least size bytes, the
+// lowest such block in memory on ties, or NULL if there is none.
+// Walks a single path from the root so takes O(log n) steps. With
+// EL_ADDRESS_ORDER the tree is not ordered by size so the lowest
+// block in memory that fits is returned instead.
+el_blockhead_t *el_tree_find(size_t size){
+  if(!(el_ctl->flags & EL_BEST_FIT)){
+    return el_tree_find_first(size);
+  }
+  el_blockhead_t *best = NULL;
+  el_blockhead_t *block = el_ctl->avail_tree;
+  while(block != NULL){
+    if(block->size >= size){
+      best = block;
+      block = EL_LEFT(block);
+    }
+    else{
+      block = EL_RIGHT(block);
+    }
+  }
+  return best;
+}
+
+// Print the blocks of the tree under block in order, numbering them
+// from *index in the format of el_print_blocklist()
+static void el_tree_print(el_blockhead_t *block, int *index){
+  if(block == NULL){
+    return;
+  }
+  el_tree_print(EL_LEFT(block), index);
+  printf("  [%3d] head @ %p {state: %c  size: %5lu  height: %d}\n",
+         *index, block, block->state, (size_t) block->size, (int) block->height);
+  (*index)++;
+  el_tree_print(EL_RIGHT(block), index);
+}
+
+// Print the tree of available blocks in order of size, or of address
+// with EL_ADDRESS_ORDER
+void el_print_tree(){
+  printf("{length: %3lu  bytes: %5lu  root: %p}\n",
+         el_ctl->avail->length, el_ctl->avail->bytes, el_ctl->avail_tree);
+  int index = 0;
+  el_tree_print(el_ctl->avail_tree, &index);
+}
+
+// Return the list that should hold an available block of the given
+// size. This is the single available list by default, the size-class
+// bin for that size with EL_SEGREGATED, or the list of its order with
+// EL_BUDDY.
+el_blocklist_t *el_avail_list(size_t size){
+  if(el_ctl->flags & EL_BUDDY){
+    return &el_ctl->bins[el_buddy_order(size + EL_BLOCK_OVERHEAD)][0];
+  }
+  if(el_ctl->flags & EL_SEGREGATED){
+    int fl, sl;
+    el_bin_index(size, &fl, &sl);
+    return &el_ctl->bins[fl][sl];
+  }
+  return el_ctl->avail;
+}
+
+// Add an available block to the front of the list that tracks blocks
+// of its size, or into the tree of available blocks with EL_BEST_FIT
+// or EL_ADDRESS_ORDER. All available blocks should be added through
+// this function so that size-class bins and their bitmaps stay
+// consistent.
+void el_add_avail(el_blockhead_t *block){
+  if(el_ctl->flags & EL_BUDDY){
+    int k = el_buddy_order(block->size + EL_BLOCK_OVERHEAD);
+    el_add_block_front(&el_ctl->bins[k][0], block);
+    el_ctl->fl_bitmap |= (1UL << k);
+    return;
+  }
+  if(el_ctl->flags & (EL_BEST_FIT | EL_ADDRESS_ORDER)){
+    el_ctl->avail_tree = el_tree_insert(el_ctl->avail_tree, block);
+    el_ctl->avail->length++;
+    el_ctl->avail->bytes += block->size + EL_BLOCK_OVERHEAD;
+    return;
+  }
+  if(el_ctl->flags & EL_SEGREGATED){
+    int fl, sl;
+    el_bin_index(block->size, &fl, &sl);
+    el_add_block_front(&el_ctl->bins[fl][sl], block);
+    el_ctl->fl_bitmap |= (1UL << fl);
+    el_ctl->sl_bitmap[fl] |= (1U << sl);
+    return;
+  }
+  el_add_block_front(el_ctl->avail, block);
+}
+
+// Remove an available block from the list that tracks blocks of its
+// size. The block size must not have changed since it was added.
+void el_remove_avail(el_blockhead_t *block){
+  if(el_ctl->flags & EL_BUDDY){
+    int k = el_buddy_order(block->size + EL_BLOCK_OVERHEAD);
+    el_remove_block(&el_ctl->bins[k][0], block);
+    if(el_ctl->bins[k][0].length == 0){
+      el_ctl->fl_bitmap &= ~(1UL << k);
+    }
+    return;
+  }
+  if(el_ctl->flags & (EL_BEST_FIT | EL_ADDRESS_ORDER)){
+    el_ctl->avail_tree = el_tree_remove(el_ctl->avail_tree, block);
+    el_ctl->avail->length--;
+    el_ctl->avail->bytes -= block->size + EL_BLOCK_OVERHEAD;
+    return;
+  }
+  if(el_ctl->flags & EL_SEGREGATED){
+    int fl, sl;
+    el_bin_index(block->size, &fl, &sl);
+    el_blocklist_t *bin = &el_ctl->bins[fl][sl];
+    el_remove_block(bin, block);
+    if(bin->length == 0){
+      el_ctl->sl_bitmap[fl] &= ~(1U << sl);
+      if(el_ctl->sl_bitmap[fl] == 0){
+        el_ctl->fl_bitmap &= ~(1UL << fl);
+      }
+    }
+    return;
+  }
+  el_remove_block(el_ctl->avail, block);
+}
+
+// Add a block that has been handed to the user to the used list. With
+// EL_NO_USED_LIST used blocks are not linked so only the length and
+// bytes of the used list are tracked.
+void el_add_used(el_blockhead_t *block){
+#ifdef EL_NO_USED_LIST
+  el_ctl->used->length++;
+  el_ctl->used->bytes += block->size + EL_BLOCK_OVERHEAD;
+#else
+  el_add_block_front(el_ctl->used, block);
+#endif
+}
+
+// Remove a block being freed from the used list
+void el_remove_used(el_blockhead_t *block){
+#ifdef EL_NO_USED_LIST
+  el_ctl->used->length--;
+  el_ctl->used->bytes -= block->size + EL_BLOCK_OVERHEAD;
+#else
+  el_remove_block(el_ctl->used, block);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Quick lists for deferred coalescing
+//
+// With EL_DEFERRED small blocks being freed are not merged with their
+// neighbors. They go in state EL_QUICK on the quick list for their
+// exact size, doubly linked through their next/prev fields, so that a later
+// request of that size takes one back without any merging or
+// splitting. Neighbors treat them as used. el_consolidate() later
+// coalesces them all at once.
+
+// Return the quick list index for blocks of the given rounded size or
+// -1 if blocks of that size are not deferred
+static int el_quick_class(size_t size){
+  size_t min = el_round_size(0);
+  if(size < min || (size - min) / EL_ALIGNMENT >= EL_QUICK_CLASSES){
+    return -1;
+  }
+  return (size - min) / EL_ALIGNMENT;
+}
+
+// Put a block just removed from the used list on the quick list for
+// its size. Returns 1 on success or 0 if blocks of its size are not
+// deferred.
+static int el_quick_put(el_blockhead_t *block){
+  int c = el_quick_class(block->size);
+  if(c < 0){
+    return 0;
+  }
+  block->state = EL_QUICK;
+  block->prev = NULL;
+  block->next = el_ctl->quick[c];
+  if(block->next != NULL){
+    block->next->prev = block;
+  }
+  el_ctl->quick[c] = block;
+  el_ctl->quick_count++;
+  el_ctl->quick_bytes += block->size + EL_BLOCK_OVERHEAD;
+  return 1;
+}
+
+// Remove a block from the quick list it is on. It keeps state
+// EL_QUICK for the caller to change.
+static void el_quick_unlink(el_blockhead_t *block){
+  if(block->prev != NULL){
+    block->prev->next = block->next;
+  }
+  else{
+    el_ctl->quick[el_quick_class(block->size)] = block->next;
+  }
+  if(block->next != NULL){
+    block->next->prev = block->prev;
+  }
+  el_ctl->quick_count--;
+  el_ctl->quick_bytes -= block->size + EL_BLOCK_OVERHEAD;
+}
+
+// Take a block of exactly the given rounded size off its quick list
+// and return it, or NULL if that list is empty. The block keeps state
+// EL_QUICK for the caller to change.
+static el_blockhead_t *el_quick_get(size_t size){
+  if(el_ctl->quick_count == 0){
+    return NULL;
+  }
+  int c = el_quick_class(size);
+  if(c < 0 || el_ctl->quick[c] == NULL){
+    return NULL;
+  }
+  el_blockhead_t *block = el_ctl->quick[c];
+  el_quick_unlink(block);
+  return block;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Zero memory tracking
+//
+// Pages from mmap() are zero filled. el_ctl->zero_start marks the
+// lowest address in the heap not yet handed out to a user: above it
+// the only non-zero bytes are the headers/footers of the blocks that
+// currently exist. Merging blocks above the mark clears the boundary
+// they absorb so el_calloc() can skip zeroing anything above it.
+
+// Advance zero_start past the usable space of a block being handed
+// to the user.
+void el_mark_dirty(el_blockhead_t *block){
+  void *end = PTR_PLUS_BYTES(block, EL_HEAD_BYTES + block->size);
+  if(end > el_ctl->zero_start){
+    el_ctl->zero_start = end;
+  }
+}
+
+// Zero the footer of a block and the header of the available block
+// above it, including its links, which are about to become part of a
+// merged block if any of them lies above zero_start.
+void el_clear_boundary(el_blockfoot_t *foot){
+  size_t bytes = sizeof(el_blockfoot_t) + sizeof(el_blockhead_t);
+  if(PTR_PLUS_BYTES(foot, bytes) > el_ctl->zero_start){
+    memset(foot, 0, bytes);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // Allocation-related functions
 
+// Find an available block of at least `size` in the size-class bins
+// in constant time. The size is rounded up to the start of the next
+// bin so that every block in the bins searched is large enough, then
+// the bitmaps locate the lowest non-empty such bin with a
+// count-trailing-zeros instruction. This is TLSF's good fit: a block
+// in the bin of `size` itself that happens to fit is not searched for,
+// so a miss here leads to growth of the heap.
+static el_blockhead_t *el_find_in_bins(size_t size){
+  int fl, sl;
+  size_t rounded = size;
+  if(size >= EL_SL_COUNT){
+    int msb = 63 - __builtin_clzl(size);
+    rounded += (1UL << (msb - EL_SL_LOG2)) - 1;
+    if(rounded < size) rounded = size;      // overflow on huge sizes
+  }
+  el_bin_index(rounded, &fl, &sl);
+
+  unsigned int sl_map = el_ctl->sl_bitmap[fl] & (~0U << sl);
+  if(sl_map == 0){
+    size_t fl_map = (fl+1 < EL_FL_COUNT) ? el_ctl->fl_bitmap & (~0UL << (fl+1)) : 0;
+    if(fl_map != 0){
+      fl = __builtin_ctzl(fl_map);
+      sl_map = el_ctl->sl_bitmap[fl];
+    }
+  }
+  if(sl_map == 0){
+    return NULL;
+  }
+  sl = __builtin_ctz(sl_map);
+  el_blockhead_t *block = el_ctl->bins[fl][sl].beg->next;
+  return block->size >= size ? block : NULL;  // last bin has no upper bound
+}
+
 // REQUIRED
 // Find the first block in the available list with block size of at
 // least `size`.  Returns a pointer to the found block or NULL if no
-// block of sufficient size is available.
+// block of sufficient size is available. With EL_SEGREGATED only the
+// size-class bins that may contain a fitting block are examined; with
+// EL_BEST_FIT the smallest fitting block is found in the tree and with
+// EL_ADDRESS_ORDER the lowest one in memory. With EL_NEXT_FIT the
+// list is searched from the rover, where the last search stopped,
+// wrapping around to its start. Searches of the list and the blocks
+// they examine are counted in el_ctl.
 el_blockhead_t *el_find_first_avail(size_t size){
+  if(el_ctl->flags & (EL_BEST_FIT | EL_ADDRESS_ORDER)){
+    return el_tree_find(size);
+  }
+  if(el_ctl->flags & EL_SEGREGATED){
+    return el_find_in_bins(size);
+  }
+  el_ctl->search_count++;
+
+  if(el_ctl->flags & EL_NEXT_FIT){
+    el_blocklist_t *avail = el_ctl->avail;
+    el_blockhead_t *rover = el_ctl->rover != NULL ? el_ctl->rover : avail->beg->next;
+    for(el_blockhead_t *block = rover; block != avail->end; block = block->next){
+      el_ctl->search_steps++;
+      if(block->size >= size){
+        el_ctl->rover = block;
+        return block;
+      }
+    }
+    for(el_blockhead_t *block = avail->beg->next; block != rover; block = block->next){
+      el_ctl->search_steps++;
+      if(block->size >= size){
+        el_ctl->rover = block;
+        return block;
+      }
+    }
+    return NULL;
+  }
+
   el_blockhead_t *block = el_ctl->avail->beg;
 
   // Iterate through each block. If end is not next node:
   while(block->next != el_ctl->avail->end){
     // Get next block
     block = block->next;
+    el_ctl->search_steps++;
 
     // Check if block is avalible. // Check if block size is large enough. If yes, return block
     if (block->state == EL_AVAILABLE) if(block->size >= size) return block;
@@ -282,142 +1391,654 @@ el_blockhead_t *el_find_first_avail(size_t size){
 // created block while the parameter block has its size altered to
 // parameter size. Does not do any linking of blocks.  If the
 // parameter block does not have sufficient size for a split (at least
-// new_size + EL_BLOCK_OVERHEAD for the new header/footer) makes no
-// changes tot the block and returns NULL indicating no new block was
-// created.
+// new_size + EL_BLOCK_OVERHEAD for the new header/footer plus
+// EL_MIN_SIZE) makes no changes tot the block and returns NULL
+// indicating no new block was created.
 el_blockhead_t *el_split_block(el_blockhead_t *block, size_t size_NEW){
   // Check if there's not enough space to split. If there isn't, return NULL
-  if (block->size < (size_NEW + EL_BLOCK_OVERHEAD)) return NULL;
+  if (block->size < (size_NEW + EL_BLOCK_OVERHEAD + EL_MIN_SIZE)) return NULL;
 
-  // Get foot of the current block, and save the block's current size
-  el_blockfoot_t* foot = el_get_footer(block); 
+  // Save the block's current size
   size_t size_OLD = block->size; 
 
   // Change the block's designated size to size_NEW
   block->size = size_NEW; 
 
-  // Create a new foot pointer to the foot of block, and set it to the new size
-  el_blockfoot_t* foot_NEW = el_get_footer(block); 
-  foot_NEW->size = size_NEW; 
-
   // Create a new header (block_NEW) in the memory space left by block we just shrank
   // Set new block's size equal to the remainder of the old block size - the new block size
   el_blockhead_t* block_NEW = el_block_above(block); 
   block_NEW->size = size_OLD - (size_NEW + EL_BLOCK_OVERHEAD);  
   block_NEW->state = EL_AVAILABLE;
 
-  // The original foot pointer we got is now the foot of the new block, so set it's size to the size of the new block
-  foot->size = block_NEW->size; 
+  // Write the footers of both blocks; the original footer is now the footer of the new block
+  el_write_footer(block);
+  el_write_footer(block_NEW);
 
   // Return a pointer to the new block
   return block_NEW;
 }
 
+// Round a request of nbytes up to the block size used for it. The
+// heap starts page aligned and headers are EL_ALIGNMENT aligned, so
+// user pointers stay aligned as long as every block size plus
+// EL_BLOCK_OVERHEAD is a multiple of EL_ALIGNMENT. Splitting a block
+// of such a size into two such sizes leaves a remainder of such a
+// size too. Returns 0 if the rounded size would overflow.
+size_t el_round_size(size_t nbytes){
+  if(nbytes > EL_MAX_SIZE){
+    return 0;
+  }
+  if(nbytes < EL_MIN_SIZE){
+    nbytes = EL_MIN_SIZE;
+  }
+  size_t total = nbytes + EL_BLOCK_OVERHEAD + EL_ALIGNMENT - 1;
+  total -= total % EL_ALIGNMENT;
+  return total - EL_BLOCK_OVERHEAD;
+}
+
 // REQUIRED
 // Return pointer to a block of memory with at least the given size
 // for use by the user.  The pointer returned is to the usable space,
-// not the block header. Makes use of find_first_avail() to find a
-// suitable block and el_split_block() to split it.  Returns NULL if
-// no space is available.
-void *el_malloc(size_t nbytes){
+// not the block header and is aligned to EL_ALIGNMENT bytes. Makes use
+// of find_first_avail() to find a suitable block and el_split_block()
+// to split it.  If no block is large enough, the heap is grown with
+// el_grow_heap(). Blocks of at least el_ctl->mmap_threshold bytes are
+// instead given a mapping of their own with el_map_alloc() and the
+// EL_BUDDY engine allocates with el_buddy_malloc(). Returns NULL if no
+// space is available and the heap cannot grow.
+static void *el_malloc_unlocked(size_t nbytes){
+  // Round up so the block after this one stays aligned
+  nbytes = el_round_size(nbytes);
+  if (nbytes == 0) return NULL;
+
+  // Large blocks stay out of the heap so their pages go straight back
+  // to the OS when freed
+  if (el_ctl->mmap_threshold > 0 && nbytes >= el_ctl->mmap_threshold){
+    return el_map_alloc(nbytes);
+  }
+  if (el_ctl->flags & EL_BUDDY){
+    return el_buddy_malloc(nbytes);
+  }
+
+  // A deferred block of exactly this size is reused as it is
+  el_blockhead_t *quick = el_quick_get(nbytes);
+  if (quick != NULL){
+    quick->state = EL_USED;
+    el_add_used(quick);
+    return PTR_PLUS_BYTES(quick,EL_HEAD_BYTES);
+  }
+
   // Locate a block of nbytes size or larger
-  // If no such block exists, return NULL
+  // If no such block exists, coalesce any deferred blocks and look
+  // again, then grow the heap to create one and return NULL only if
+  // that fails
   el_blockhead_t* block = el_find_first_avail(nbytes);
+  if (block == NULL && el_ctl->quick_count > 0){
+    el_consolidate();
+    block = el_find_first_avail(nbytes);
+  }
+  if (block == NULL) block = el_grow_heap(nbytes);
   if (block == NULL) return NULL;
 
   // Remove the located block from the control heap
-  el_remove_block(el_ctl->avail, block); 
+  el_remove_avail(block); 
 
   // For the block of memory thats >= nbytes, split any excess off so that it's exactly nbytes big
   el_blockhead_t* new_block = el_split_block(block, nbytes);
 
   // If any excess space is returned (as new_block), add it back into the 'avalible' list of the control heap
-  if (new_block != NULL) el_add_block_front(el_ctl->avail, new_block);   
+  if (new_block != NULL) el_add_avail(new_block);   
   
   // Set the block's state to USED
   // Add it to the front of the 'used' list of the control heap
   block->state = EL_USED;
-  el_add_block_front(el_ctl->used, block);
+  el_write_footer(block);
+  el_add_used(block);
+
+  // Memory handed to the user is no longer known to be zero
+  el_mark_dirty(block);
   
   // Returns a pointer to the block
-  return PTR_PLUS_BYTES(block,sizeof(el_blockhead_t));
+  return PTR_PLUS_BYTES(block,EL_HEAD_BYTES);
 }
 
-////////////////////////////////////////////////////////////////////////////////
-// De-allocation/free() related functions
+// el_malloc() with the arena of the calling thread locked when built
+// with EL_THREADSAFE; small requests are served from the thread cache
+// without locking when it has a block of their size
+void *el_malloc(size_t nbytes){
+  void *result = NULL;
+#ifdef EL_THREADSAFE
+  result = el_tcache_get(nbytes);
+#endif
+  if(result == NULL){
+    el_lock_arena(NULL);
+#ifdef EL_THREADSAFE
+    el_tcache_tally();
+#endif
+    result = el_malloc_unlocked(nbytes);
+    el_unlock_arena();
+  }
+  if(el_trace.file != NULL){
+    el_trace_record(EL_TRACE_MALLOC, 0, result, nbytes, 0);
+  }
+  return result;
+}
 
-// REQUIRED
-// Attempt to merge the block lower with the next block in
-// memory. Does nothing if lower is null or not EL_AVAILABLE and does
-// nothing if the next higher block is null (because lower is the last
-// block) or not EL_AVAILABLE.  Otherwise, locates the next block with
-// el_block_above() and merges these two into a single block. Adjusts
-// the fields of lower to incorporate the size of higher block and the
-// reclaimed overhead. Adjusts footer of higher to indicate the two
-// blocks are merged.  Removes both lower and higher from the
-// available list and re-adds lower to the front of the available
-// list.
-void el_merge_block_with_above(el_blockhead_t *lower){
-  // Check if the block in the argument is NULL. If so, return.
-  if (lower == NULL) return;
+// Return a pointer to at least nbytes of usable space whose address
+// is a multiple of alignment which must be a power of two. Alignments
+// up to EL_ALIGNMENT are met by el_malloc(). Otherwise a heap block large
+// enough to hold nbytes at an aligned address behind some leading
+// slack is located. The slack is split off with el_split_block() into
+// an available block of its own and any excess at the end is split
+// off as in el_malloc() so no space is wasted. Returns NULL if
+// alignment is not a power of two or no space is available. The
+// EL_BUDDY engine only meets alignments up to EL_ALIGNMENT as its
+// blocks cannot be split at arbitrary addresses.
+static void *el_aligned_alloc_unlocked(size_t alignment, size_t nbytes){
+  if(alignment == 0 || (alignment & (alignment-1)) != 0){
+    return NULL;
+  }
+  if(alignment <= EL_ALIGNMENT){
+    return el_malloc_unlocked(nbytes);
+  }
+  if(el_ctl->flags & EL_BUDDY){
+    return NULL;
+  }
+  nbytes = el_round_size(nbytes);
+  if(nbytes == 0 || nbytes > SIZE_MAX - alignment - EL_BLOCK_OVERHEAD){
+    return NULL;
+  }
+
+  // Leading slack is either 0 or a whole block of at least the
+  // minimum size so the worst case is a little over alignment bytes
+  size_t min_lead = el_round_size(0) + EL_BLOCK_OVERHEAD;
+  size_t search = nbytes + alignment + min_lead - EL_ALIGNMENT;
+  el_blockhead_t *block = el_find_first_avail(search);
+  if(block == NULL && el_ctl->quick_count > 0){
+    el_consolidate();
+    block = el_find_first_avail(search);
+  }
+  if(block == NULL) block = el_grow_heap(search);
+  if(block == NULL) return NULL;
+  el_remove_avail(block);
+
+  // Split the leading slack off as its own available block; the
+  // block below is not available as available blocks never touch
+  size_t user = (size_t) PTR_PLUS_BYTES(block, EL_HEAD_BYTES);
+  if(user % alignment != 0){
+    size_t aligned = (user + min_lead + alignment - 1) & ~(alignment - 1);
+    el_blockhead_t *lead = block;
+    block = el_split_block(lead, aligned - user - EL_BLOCK_OVERHEAD);
+    el_add_avail(lead);
+  }
 
-  // 'lower' is not NULL. Check if the block in the argument is avalible. If so, continue,
-  if (lower->state == EL_AVAILABLE){
-    // Get the pointer for the block in memory above the argument 'lower' (named 'higher')
-    el_blockhead_t* higher = el_block_above(lower);
+  el_blockhead_t *tail = el_split_block(block, nbytes);
+  if(tail != NULL) el_add_avail(tail);
+  block->state = EL_USED;
+  el_write_footer(block);
+  el_add_used(block);
+  el_mark_dirty(block);
+  return PTR_PLUS_BYTES(block, EL_HEAD_BYTES);
+}
 
-    // Check if the 'higher' block is NULL. If so, return.
-    if (higher == NULL) return;
+// el_aligned_alloc() with the arena of the calling thread locked
+void *el_aligned_alloc(size_t alignment, size_t nbytes){
+  el_lock_arena(NULL);
+  void *result = el_aligned_alloc_unlocked(alignment, nbytes);
+  el_unlock_arena();
+  if(el_trace.file != NULL){
+    el_trace_record(EL_TRACE_ALIGNED, 0, result, nbytes, alignment);
+  }
+  return result;
+}
 
-    // 'higher' is not NULL. Check if the 'higher' block is avalibleL. If so: merge lower and higher
-    if (higher->state == EL_AVAILABLE) {
-      // Remove 'lower' and 'higher' from the 'avalible' lists 
-      el_remove_block(el_ctl->avail,higher);
-      el_remove_block(el_ctl->avail,lower);
-    
-      // Get the combined size of 'lower' and 'higher' plus overhead 
-      size_t new_size = lower->size + higher->size + EL_BLOCK_OVERHEAD;
+// Return a pointer to zeroed space for an array of nmemb elements of
+// the given size. Returns NULL if nmemb*size overflows or no space is
+// available. Pages fresh from mmap() are already zero so only the part
+// of the block below el_ctl->zero_start, which may hold old data, is
+// cleared with memset().
+static void *el_calloc_unlocked(size_t nmemb, size_t size){
+  size_t nbytes;
+  if(__builtin_mul_overflow(nmemb, size, &nbytes)){
+    return NULL;
+  }
 
-      // Set the size of 'lower' to this combined size, and update it's footer accordingly
-      lower->size = new_size;
-      el_get_footer(lower)->size = new_size;
+  void *zero_start = el_ctl->zero_start;  // el_malloc() advances this
+  void *ptr = el_malloc_unlocked(nbytes);
+  if(ptr == NULL){
+    return NULL;
+  }
+  if(((el_blockhead_t *) PTR_MINUS_BYTES(ptr, EL_HEAD_BYTES))->state == EL_MAPPED){
+    return ptr;                           // fresh from mmap()
+  }
+  if(ptr < zero_start){
+    size_t dirty = PTR_MINUS_PTR(zero_start, ptr);
+    memset(ptr, 0, dirty < nbytes ? dirty : nbytes);
+  }
+#ifdef EL_COMPACT_HEADERS
+  // links and footer of the formerly available block are in the usable space
+  el_blockhead_t *block = PTR_MINUS_BYTES(ptr, EL_HEAD_BYTES);
+  memset(ptr, 0, 2*sizeof(el_blockhead_t *));
+  memset(el_get_footer(block), 0, sizeof(el_blockfoot_t));
+#endif
+  return ptr;
+}
+
+// el_calloc() with the arena of the calling thread locked
+void *el_calloc(size_t nmemb, size_t size){
+  el_lock_arena(NULL);
+  void *result = el_calloc_unlocked(nmemb, size);
+  el_unlock_arena();
+  size_t nbytes;
+  if(el_trace.file != NULL && !__builtin_mul_overflow(nmemb, size, &nbytes)){
+    el_trace_record(EL_TRACE_CALLOC, 0, result, nbytes, 0);
+  }
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// De-allocation/free() related functions
 
-      // Add the newly merged 'lower' back into the 'avalible' list
-      el_add_block_front(el_ctl->avail,lower);
+// Absorb the block upper, which lies directly above lower in memory
+// and is in no list, into lower. The boundary between them is cleared
+// if it lies above zero_start. The footer of lower is left stale.
+static void el_absorb(el_blockhead_t *lower, el_blockhead_t *upper){
+  el_blockfoot_t *foot = el_get_footer(lower);
+  lower->size += upper->size + EL_BLOCK_OVERHEAD;
+  el_clear_boundary(foot);
+}
 
-      // Recursively call the function again with the merged 'lower' to check if the next block should also be merged
-      el_merge_block_with_above(lower);
+// Make block, which must be free but in no list, available after
+// merging it with the maximal run of free blocks around it in a single
+// pass. Available blocks below and available or deferred blocks above
+// are unlinked from their lists as they are absorbed, then the merged
+// block gets its footer and is added to the available blocks once.
+// Without deferral the run is at most one block either side; with
+// EL_DEFERRED it may span any number of deferred blocks above, each
+// absorbed in constant time. Deferred blocks below have no footer with
+// EL_COMPACT_HEADERS so are left for their own turn to absorb this run.
+// Returns the merged block.
+static el_blockhead_t *el_coalesce(el_blockhead_t *block){
+  el_blockhead_t *below = el_block_below(block);
+  while(below != NULL && below->state == EL_AVAILABLE){
+    el_remove_avail(below);
+    el_absorb(below, block);
+    block = below;
+    below = el_block_below(block);
+  }
+  el_blockhead_t *above = el_block_above(block);
+  while(above != NULL && (above->state == EL_AVAILABLE || above->state == EL_QUICK)){
+    if(above->state == EL_AVAILABLE){
+      el_remove_avail(above);
     }
+    else{
+      el_quick_unlink(above);
+    }
+    el_absorb(block, above);
+    above = el_block_above(block);
+  }
+  block->state = EL_AVAILABLE;
+  el_write_footer(block);
+  el_add_avail(block);
+  return block;
+}
 
-    // Get the pointer for the block in memory below the argument 'lower' (named 'lowerer')
-    el_blockhead_t* lowerer = el_block_below(lower);
+// REQUIRED
+// Attempt to merge the block lower with the blocks next to it in
+// memory. Does nothing if lower is null or not EL_AVAILABLE. Otherwise
+// lower is removed from the available blocks and merged with the run
+// of free blocks around it by el_coalesce() which adds the result back
+// once.
+void el_merge_block_with_above(el_blockhead_t *lower){
+  if(lower == NULL || lower->state != EL_AVAILABLE){
+    return;
+  }
+  el_remove_avail(lower);
+  el_coalesce(lower);
+}
 
-    // Check if the 'lowerer' block is NULL. If so, return.
-    if (lowerer == NULL) return;
-    
-    // 'lowerer' is not NULL. Check if the 'lowerer' block is avalible.
-    //  If so, recursively call the function with 'lowerer' to try and merge it with 'lower'
-    if (lowerer->state == EL_AVAILABLE) 
-        el_merge_block_with_above(lowerer);
+// Coalesce every block on the quick lists with its neighbors, leaving
+// the quick lists empty
+void el_consolidate(){
+  for(int c=0; c<EL_QUICK_CLASSES; c++){
+    while(el_ctl->quick[c] != NULL){
+      el_blockhead_t *block = el_ctl->quick[c];
+      el_quick_unlink(block);
+      el_coalesce(block);
+    }
   }
+  el_ctl->consolidations++;
 }
 
 // REQUIRED
 // Free the block pointed to by the give ptr.  The area immediately
 // preceding the pointer should contain an el_blockhead_t with information
-// on the block size. Attempts to merge the free'd block with adjacent
-// blocks using el_merge_block_with_above().
-void el_free(void *ptr){
+// on the block size. Merges the free'd block with adjacent free blocks
+// using el_coalesce(). If the available block at the top of the heap
+// is then larger than el_ctl->trim_threshold, the heap is trimmed to
+// keep half the threshold. A block in a mapping of
+// its own is unmapped with el_map_free() and the EL_BUDDY engine
+// merges blocks with el_buddy_release() instead. With EL_DEFERRED
+// small blocks go on quick lists instead, which are coalesced once
+// they hold more than el_ctl->quick_threshold blocks. A NULL ptr is
+// ignored.
+static void el_free_unlocked(void *ptr){
+  // Freeing NULL does nothing, as with free()
+  if (ptr == NULL) return;
+
   // Get the block pointed to by pointer 'ptr'
-  el_blockhead_t *free = PTR_MINUS_BYTES(ptr, sizeof(el_blockhead_t));
+  el_blockhead_t *free = PTR_MINUS_BYTES(ptr, EL_HEAD_BYTES);
+  if (free->state == EL_MAPPED){
+    el_map_free(free);
+    return;
+  }
+  if (el_ctl->flags & EL_BUDDY){
+    el_remove_used(free);
+    el_buddy_release(free);
+    return;
+  }
+
+  // Remove the pointed to block from the 'used' control heap list
+  el_remove_used(free);
+
+  // With EL_DEFERRED a small block waits on a quick list until enough
+  // have gathered to coalesce them all at once
+  if ((el_ctl->flags & EL_DEFERRED) && el_quick_put(free)){
+    if (el_ctl->quick_count <= el_ctl->quick_threshold) return;
+    el_consolidate();
+  }
+  else{
+    // Make the block available, merging it with any adjacent blocks in memory
+    el_coalesce(free);
+  }
+
+  // Return pages to the OS if the free block at the top of the heap
+  // has grown beyond the trim threshold
+  el_blockhead_t *top = el_top_avail();
+  if(el_ctl->trim_threshold > 0 && top != NULL &&
+     top->size > el_ctl->trim_threshold)
+  {
+    el_trim_top(el_ctl->trim_threshold / 2);
+  }
+}
+
+// el_free() with the arena that owns ptr locked. When built with
+// EL_THREADSAFE, blocks of another thread's arena go on its remote
+// free stack and small blocks go to the thread cache instead. A trace
+// records the free before the block can be handed out again.
+void el_free(void *ptr){
+  if(el_trace.file != NULL && ptr != NULL){
+    el_trace_record(EL_TRACE_FREE, el_trace_forget(ptr), NULL, 0, 0);
+  }
+#ifdef EL_THREADSAFE
+  if(ptr == NULL){
+    return;
+  }
+  el_ctl_t *owner = el_arena_of(ptr);
+  if(owner != el_home_arena()){
+    el_remote_push(owner, ptr);
+    return;
+  }
+  if(el_tcache_put(ptr)){
+    return;
+  }
+#endif
+  el_lock_arena(ptr);
+  el_free_unlocked(ptr);
+  el_unlock_arena();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Re-allocation functions
+
+// Change the size of the used block at ptr to nbytes and return a
+// pointer to its usable space, preserving its contents up to the
+// smaller of the old and new sizes. Works in place when possible:
+// shrinking splits the excess off the end of the block as an
+// available block which is merged with the block above it; growing
+// absorbs an available block above with el_block_above(), growing the
+// heap first if the block is at its top. Only if neither works is a
+// new block allocated, the contents copied, and the old block
+// freed. A heap block growing to el_ctl->mmap_threshold moves to a
+// mapping of its own; a mapped block is resized with el_map_resize()
+// without copying unless it shrinks below the threshold and moves
+// back to the heap. The EL_BUDDY engine keeps a block which is still
+// large enough and otherwise moves it. A NULL ptr behaves like
+// el_malloc() and an nbytes of 0 frees ptr and returns NULL. Returns
+// NULL if no space is available in which case ptr is unchanged.
+static void *el_realloc_unlocked(void *ptr, size_t nbytes){
+  if(ptr == NULL){
+    return el_malloc_unlocked(nbytes);
+  }
+  if(nbytes == 0){
+    el_free_unlocked(ptr);
+    return NULL;
+  }
+
+  nbytes = el_round_size(nbytes);
+  if(nbytes == 0){
+    return NULL;
+  }
+
+  el_blockhead_t *block = PTR_MINUS_BYTES(ptr, EL_HEAD_BYTES);
+  size_t old_size = block->size;
+  int large = el_ctl->mmap_threshold > 0 && nbytes >= el_ctl->mmap_threshold;
+
+  if(block->state == EL_MAPPED){
+    if(large){
+      return el_map_resize(block, nbytes);
+    }
+    void *new_ptr = el_malloc_unlocked(nbytes);
+    if(new_ptr == NULL){
+      return NULL;
+    }
+    memcpy(new_ptr, ptr, nbytes);
+    el_map_free(block);
+    return new_ptr;
+  }
+
+  if(el_ctl->flags & EL_BUDDY){
+    if(nbytes <= block->size){
+      return ptr;
+    }
+    void *new_ptr = el_malloc_unlocked(nbytes);
+    if(new_ptr == NULL){
+      return NULL;
+    }
+    memcpy(new_ptr, ptr, old_size);
+    el_free_unlocked(ptr);
+    return new_ptr;
+  }
+
+  // Shrink in place by splitting off the tail
+  if(nbytes <= block->size){
+    el_blockhead_t *tail = el_split_block(block, nbytes);
+    if(tail != NULL){
+      el_ctl->used->bytes -= old_size - block->size;   // block stays in the used list at its new size
+      el_coalesce(tail);
+    }
+    return ptr;
+  }
+
+  // Grow in place by absorbing the available block above, first
+  // growing the heap if this block or the one above is at its top.
+  // Blocks growing past the mmap threshold move to a mapping instead.
+  el_blockhead_t *above = el_block_above(block);
+  if(!large && (above == NULL ||
+     (above->state == EL_AVAILABLE && el_block_above(above) == NULL &&
+      block->size + above->size + EL_BLOCK_OVERHEAD < nbytes)))
+  {
+    size_t need = nbytes > block->size + EL_BLOCK_OVERHEAD ?
+      nbytes - block->size - EL_BLOCK_OVERHEAD : 0;
+    el_blockhead_t *top = el_grow_heap(need);
+    if(top != NULL){
+      above = top;
+    }
+  }
+  if(!large && above != NULL && above->state == EL_AVAILABLE &&
+     block->size + above->size + EL_BLOCK_OVERHEAD >= nbytes)
+  {
+    el_remove_avail(above);
+    block->size += above->size + EL_BLOCK_OVERHEAD;
+    el_write_footer(block);
+    el_blockhead_t *tail = el_split_block(block, nbytes);
+    if(tail != NULL){
+      el_add_avail(tail);
+    }
+    el_ctl->used->bytes += block->size - old_size;     // block stays in the used list at its new size
+    el_mark_dirty(block);
+    return ptr;
+  }
+
+  // Move to a new block
+  void *new_ptr = el_malloc_unlocked(nbytes);
+  if(new_ptr == NULL){
+    return NULL;
+  }
+  memcpy(new_ptr, ptr, old_size);
+  el_free_unlocked(ptr);
+  return new_ptr;
+}
+
+// el_realloc() with the arena that owns ptr, or the arena of the
+// calling thread if ptr is NULL, locked. A trace forgets ptr before
+// it may be freed and gives its ID to the result; if the call fails
+// ptr keeps its ID and nothing is recorded.
+void *el_realloc(void *ptr, size_t nbytes){
+  uint32_t id = 0;
+  if(el_trace.file != NULL && ptr != NULL){
+    id = el_trace_forget(ptr);
+  }
+  el_lock_arena(ptr);
+  void *result = el_realloc_unlocked(ptr, nbytes);
+  el_unlock_arena();
+  if(el_trace.file != NULL){
+    if(result == NULL && nbytes > 0){
+      el_trace_restore(ptr, id);
+    }
+    else{
+      el_trace_record(EL_TRACE_REALLOC, id, result, nbytes, 0);
+    }
+  }
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// LARGE MAPPING FUNCTIONS
+
+// Return the bytes to map for a block of the given size, rounded up
+// to whole pages, or 0 if that would overflow
+static size_t el_map_bytes(size_t size){
+  if(size > SIZE_MAX - EL_MAP_OFFSET - EL_PAGE_BYTES){
+    return 0;
+  }
+  size_t bytes = size + EL_MAP_OFFSET + EL_PAGE_BYTES - 1;
+  return bytes - bytes % EL_PAGE_BYTES;
+}
+
+// Add a mapping to the front of the mapped list of its control
+static void el_map_link(el_map_t *map){
+  el_ctl_t *ctl = map->ctl;
+  map->prev = NULL;
+  map->next = ctl->mapped;
+  if(ctl->mapped != NULL){
+    ctl->mapped->prev = map;
+  }
+  ctl->mapped = map;
+  ctl->mapped_count++;
+  ctl->mapped_bytes += map->bytes;
+}
+
+// Remove a mapping from the mapped list of its control
+static void el_map_unlink(el_map_t *map){
+  el_ctl_t *ctl = map->ctl;
+  if(map->prev != NULL){
+    map->prev->next = map->next;
+  }
+  else{
+    ctl->mapped = map->next;
+  }
+  if(map->next != NULL){
+    map->next->prev = map->prev;
+  }
+  ctl->mapped_count--;
+  ctl->mapped_bytes -= map->bytes;
+}
+
+// Set up the header of the block filling a mapping and return a
+// pointer to its usable space
+static void *el_map_block(el_map_t *map){
+  el_blockhead_t *block = PTR_PLUS_BYTES(map, EL_MAP_OFFSET - EL_HEAD_BYTES);
+  block->size = map->bytes - EL_MAP_OFFSET;
+  block->state = EL_MAPPED;
+#ifdef EL_COMPACT_HEADERS
+  block->prev_free = 0;
+#else
+  block->next = block->prev = NULL;
+#endif
+  return PTR_PLUS_BYTES(map, EL_MAP_OFFSET);
+}
+
+// Return a pointer to at least size bytes of usable space in a new
+// anonymous mapping of its own which is tracked in el_ctl->mapped
+// rather than the heap lists. The space is zero. Returns NULL if
+// mmap() fails.
+void *el_map_alloc(size_t size){
+  size_t bytes = el_map_bytes(size);
+  if(bytes == 0){
+    return NULL;
+  }
+  el_map_t *map = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(map == MAP_FAILED){
+    return NULL;
+  }
+  map->ctl = el_ctl;
+  map->bytes = bytes;
+  el_map_link(map);
+  return el_map_block(map);
+}
 
-  // Remove the pointed to block from the 'used' control heap list, and set the block's state to 'Avalible'
-  el_remove_block(el_ctl->used, free);
-  free->state = EL_AVAILABLE;
+// el_map_alloc() with the arena of the calling thread locked for use
+// outside el_malloc() whatever el_ctl->mmap_threshold is. The block is
+// freed with el_free() like any other. el_slab.c uses it for the slabs
+// of EL_BUDDY heaps which cannot place a block on a page boundary.
+void *el_map_malloc(size_t nbytes){
+  el_lock_arena(NULL);
+  void *result = el_map_alloc(nbytes);
+  el_unlock_arena();
+  if(el_trace.file != NULL){
+    el_trace_record(EL_TRACE_MALLOC, 0, result, nbytes, 0);
+  }
+  return result;
+}
 
-  // Add the block to the 'avalible' control heap list, then attempt to merge it with any agacent blocks in memory
-  el_add_block_front(el_ctl->avail, free);
-  el_merge_block_with_above(free);
+// Return the pages of a block with state EL_MAPPED to the OS
+void el_map_free(el_blockhead_t *block){
+  el_map_t *map = el_map_of(block);
+  el_map_unlink(map);
+  munmap(map, map->bytes);
+}
+
+// Change the mapping of a block with state EL_MAPPED to hold at least
+// size bytes using mremap() which may move it to a new address
+// without copying the contents. Returns a pointer to the usable space
+// or NULL if mremap() fails in which case the block is unchanged.
+void *el_map_resize(el_blockhead_t *block, size_t size){
+  el_map_t *map = el_map_of(block);
+  size_t bytes = el_map_bytes(size);
+  if(bytes == 0){
+    return NULL;
+  }
+  el_map_unlink(map);
+  el_map_t *moved = mremap(map, map->bytes, bytes, MREMAP_MAYMOVE);
+  if(moved == MAP_FAILED){
+    el_map_link(map);
+    return NULL;
+  }
+  moved->bytes = bytes;
+  el_map_link(moved);
+  return el_map_block(moved);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -442,48 +2063,638 @@ void el_free(void *ptr){
 // available list. Also attempts to merge this block with the block
 // below it. Returns 0 on success.
 int el_append_pages_to_heap(int npages){
- 
     size_t new_size = npages * EL_PAGE_BYTES;
-
-    // Create a new heap that maps pages to yjr
-    void *new_heap_segment = mmap(el_ctl->heap_end, new_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if (new_heap_segment == MAP_FAILED) {
+    if (el_extend_heap(new_size) != 0) {
         fprintf(stderr, "ERROR: Unable to mmap() additional %d pages\n", npages);
 
         // Return 1: failure to expand heap
+        return 1;
+    }
+    if (el_trace.file != NULL) {
+        el_trace_record(EL_TRACE_APPEND, 0, NULL, npages, 0);
+    }
+    return 0; // Success
+}
+
+// Maps new_size bytes at heap_end and adds them to the heap as an
+// available block which is merged with the block below it if that
+// block is also available. Returns 1 without printing anything if
+// the pages cannot be mapped contiguously with the heap and 0 on
+// success.
+static int el_extend_heap(size_t new_size){
+    // Create a new heap that maps pages to yjr; pages in space
+    // reserved for the heap replace the reservation
+    void *new_heap_segment;
+    if (el_ctl->heap_limit != NULL) {
+        if (new_size > PTR_MINUS_PTR(el_ctl->heap_limit, el_ctl->heap_end)) {
+            return 1;
+        }
+        new_heap_segment = mmap(el_ctl->heap_end, new_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    }
+    else {
+        new_heap_segment = mmap(el_ctl->heap_end, new_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (new_heap_segment == MAP_FAILED) {
         return 1; 
     }
 
     // Check that if the memory was mapped correctly
-    // If not, unmap the segment and print an error message.
+    // If not, unmap the segment
     if (new_heap_segment != el_ctl->heap_end) {
         munmap(new_heap_segment, new_size);
-        fprintf(stderr, "ERROR: Unable to mmap() additional %d pages\n", npages); 
-        
-        // Return 1: failure to expand heap
         return 1;
     }
 
-    // Update heap control structure
+    // Update heap control structure; the buddy engine divides the
+    // new space into blocks from where its last block ended
+    void *buddy_end = el_buddy_end();
     el_ctl->heap_end = (char*)el_ctl->heap_end + new_size;
     el_ctl->heap_bytes += new_size;
+    if (el_ctl->flags & EL_BUDDY) {
+        el_buddy_carve(buddy_end, el_buddy_end());
+        return 0;
+    }
 
-    // Create a new block at the newly appended area
-    el_blockhead_t *new_block = (el_blockhead_t *)new_heap_segment;
+    // Create a new block at the newly appended area; with
+    // EL_COMPACT_HEADERS it replaces the old fence, keeping its
+    // prev_free flag, and a new fence is placed at the end of the heap
+    el_blockhead_t *new_block = PTR_MINUS_BYTES(new_heap_segment, EL_HEAP_PAD);
+#ifdef EL_COMPACT_HEADERS
+    el_blockhead_t *fence = PTR_MINUS_BYTES(el_ctl->heap_end, EL_HEAP_PAD);
+    fence->size = 0;
+    fence->state = EL_END_BLOCK;
+#endif
     new_block->size = new_size - EL_BLOCK_OVERHEAD;
-    new_block->state = EL_AVAILABLE;
 
-    el_blockfoot_t *new_foot = el_get_footer(new_block);
-    new_foot->size = new_block->size;
+    // Integrate the new block into the available blocks, merging it
+    // with the previous block if it's also available
+    el_coalesce(new_block);
 
-    // Integrate the new block into the available list
-    el_add_block_front(el_ctl->avail, new_block);
+    return 0;
+}
 
-    // Attempt to merge the new block with the previous block if it's also available
-    el_blockhead_t *prev_block = el_block_below(new_block);
-    if (prev_block && prev_block->state == EL_AVAILABLE) {
-        el_merge_block_with_above(prev_block);  
+// Grows the heap so that it has an available block of at least size
+// bytes at its top and returns that block. The heap grows by enough
+// whole pages for the request beyond any available block already at
+// the top of the heap. With a grow_factor of 2 or more the heap is
+// also grown to at least grow_factor times its current size so that
+// repeated growth needs a logarithmic number of mmap() calls; if that
+// larger mapping fails the minimum is tried. The trim threshold is
+// raised to at least the bytes added so that the free block left at
+// the top is not trimmed off again by the next el_free(), as glibc
+// raises its own. Returns NULL if growth is disabled with a
+// grow_factor of 0 or the pages cannot be mapped.
+el_blockhead_t *el_grow_heap(size_t size){
+  if(el_ctl->grow_factor == 0){
+    return NULL;
+  }
+
+  if(size > SIZE_MAX - EL_BLOCK_OVERHEAD - EL_PAGE_BYTES){
+    return NULL;                                // overflow on huge sizes
+  }
+
+  // space still needed beyond a free block at the top of the heap
+  size_t need = size + EL_BLOCK_OVERHEAD;
+  el_blockhead_t *top = el_top_avail();
+  if(top != NULL){
+    if(top->size >= size){
+      return top;
     }
+    need = size - top->size;
+  }
+  size_t min_bytes = ((need + EL_PAGE_BYTES - 1) / EL_PAGE_BYTES) * EL_PAGE_BYTES;
+  size_t geo_bytes = el_ctl->heap_bytes * (el_ctl->grow_factor - 1);
 
-    return 0; // Success
+  size_t added = geo_bytes;
+  if(geo_bytes <= min_bytes || el_extend_heap(geo_bytes) != 0){
+    if(el_extend_heap(min_bytes) != 0){
+      return NULL;
+    }
+    added = min_bytes;
+  }
+  el_ctl->grow_count++;
+  if(el_ctl->trim_threshold > 0 && el_ctl->trim_threshold < added){
+    el_ctl->trim_threshold = added;
+  }
+
+  return el_top_avail();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// HEAP TRIMMING FUNCTIONS
+
+// If the block at the top of the heap is available, shrinks it to
+// leave at least keep_bytes of space in it and unmaps the whole pages
+// above that from the end of the heap. At least the first page of the
+// heap is always kept. Adjusts heap_end/heap_bytes and returns the
+// number of bytes unmapped. The EL_BUDDY engine never shrinks its
+// heap so nothing is unmapped.
+size_t el_trim_top(size_t keep_bytes){
+  if(el_ctl->flags & EL_BUDDY){
+    return 0;
+  }
+  el_blockhead_t *top = el_top_avail();
+  if(top == NULL || top->size <= keep_bytes){
+    return 0;
+  }
+
+  // new end of the heap is the first page boundary that leaves
+  // keep_bytes in the top block, which must still hold the links and
+  // footer of an available block
+  if(keep_bytes < EL_MIN_SIZE){
+    keep_bytes = EL_MIN_SIZE;
+  }
+  size_t keep_end = PTR_MINUS_PTR(top, el_ctl->heap_start) +
+    EL_BLOCK_OVERHEAD + keep_bytes + EL_HEAP_PAD;
+  keep_end = ((keep_end + EL_PAGE_BYTES - 1) / EL_PAGE_BYTES) * EL_PAGE_BYTES;
+  if(keep_end >= el_ctl->heap_bytes){
+    return 0;
+  }
+  size_t release = el_ctl->heap_bytes - keep_end;
+
+  el_remove_avail(top);
+  void *released = PTR_PLUS_BYTES(el_ctl->heap_start, keep_end);
+  if(el_ctl->heap_limit != NULL){
+    // return the pages to the reservation rather than unmapping them
+    mmap(released, release, PROT_NONE,
+         MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1, 0);
+  }
+  else{
+    munmap(released, release);
+  }
+  el_ctl->heap_bytes = keep_end;
+  el_ctl->heap_end = PTR_PLUS_BYTES(el_ctl->heap_start, keep_end);
+  if(el_ctl->zero_start > el_ctl->heap_end){
+    el_ctl->zero_start = el_ctl->heap_end;    // pages mapped again later start out zero
+  }
+#ifdef EL_COMPACT_HEADERS
+  el_blockhead_t *fence = PTR_MINUS_BYTES(el_ctl->heap_end, EL_HEAP_PAD);
+  fence->size = 0;
+  fence->state = EL_END_BLOCK;
+#endif
+  top->size -= release;
+  el_write_footer(top);
+  el_add_avail(top);
+
+  el_ctl->released_bytes += release;
+  return release;
+}
+
+// Returns unused memory in the heap to the OS. The available block at
+// the top of the heap is shrunk to keep_bytes with el_trim_top() and
+// its pages unmapped. Every other available block has the whole pages
+// inside its usable space discarded with madvise(MADV_DONTNEED) so
+// that they no longer occupy physical memory but stay mapped; their
+// contents read as zeros if touched again. Returns the total number of
+// bytes released which is also added to el_ctl->released_bytes. Pages
+// discarded with madvise() are counted each time they are released.
+// Deferred blocks are coalesced first so their space can be released.
+static size_t el_trim_unlocked(size_t keep_bytes){
+  if(el_ctl->quick_count > 0){
+    el_consolidate();
+  }
+  size_t released = el_trim_top(keep_bytes);
+
+  el_blockhead_t *block = PTR_PLUS_BYTES(el_ctl->heap_start, EL_HEAP_PAD);
+  while(block != NULL){
+    if(block->state == EL_AVAILABLE){
+      // keep the header, including links, and the footer
+      size_t beg = (size_t) PTR_PLUS_BYTES(block, sizeof(el_blockhead_t));
+      size_t end = (size_t) el_get_footer(block);
+      beg = ((beg + EL_PAGE_BYTES - 1) / EL_PAGE_BYTES) * EL_PAGE_BYTES;
+      end = (end / EL_PAGE_BYTES) * EL_PAGE_BYTES;
+      if(end > beg && madvise((void *) beg, end-beg, MADV_DONTNEED) == 0){
+        released += end-beg;
+        el_ctl->released_bytes += end-beg;
+      }
+    }
+    block = el_block_above(block);
+  }
+  return released;
+}
+
+// el_trim() with the arena of the calling thread locked
+size_t el_trim(size_t keep_bytes){
+  el_lock_arena(NULL);
+  size_t result = el_trim_unlocked(keep_bytes);
+  el_unlock_arena();
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// BUDDY ENGINE FUNCTIONS
+//
+// With EL_BUDDY the heap is divided into blocks whose total size is a
+// power of two and whose offset from el_buddy_base() is a multiple of
+// that size. A block of total size b at offset o has its buddy at
+// offset o^b; freeing merges a block with its buddy while the buddy is
+// available and whole, which needs no footers or neighbour walks.
+
+// Return the address of the first buddy block
+void *el_buddy_base(){
+  return PTR_PLUS_BYTES(el_ctl->heap_start, EL_HEAP_PAD);
+}
+
+// Return the address just past the last buddy block. Any bytes
+// between it and the end of the heap are too few for a block.
+void *el_buddy_end(){
+  size_t span = (el_ctl->heap_bytes - 2*EL_HEAP_PAD) & ~(EL_BUDDY_MIN - 1);
+  return PTR_PLUS_BYTES(el_buddy_base(), span);
+}
+
+// Return the order of the smallest buddy block with at least bytes
+// total size
+int el_buddy_order(size_t bytes){
+  if(bytes <= EL_BUDDY_MIN){
+    return 0;
+  }
+  return 64 - __builtin_clzl(bytes - 1) - EL_BUDDY_MIN_LOG2;
+}
+
+// Make a block whose size is set but whose state and links are not
+// available, first merging it with its buddy for as long as the buddy
+// is an available block of the same size. The boundary between merged
+// buddies is cleared as in el_merge_block_with_above().
+void el_buddy_release(el_blockhead_t *block){
+  void *base = el_buddy_base();
+  size_t span = PTR_MINUS_PTR(el_buddy_end(), base);
+  size_t bytes = block->size + EL_BLOCK_OVERHEAD;
+  while(el_buddy_order(bytes) < EL_FL_COUNT-1){
+    size_t buddy_off = PTR_MINUS_PTR(block, base) ^ bytes;
+    if(buddy_off + bytes > span){
+      break;                                    // buddy runs off the heap
+    }
+    el_blockhead_t *buddy = PTR_PLUS_BYTES(base, buddy_off);
+    if(buddy->state != EL_AVAILABLE || buddy->size != block->size){
+      break;                                    // buddy is used or split
+    }
+    el_remove_avail(buddy);
+    if(buddy < block){
+      block = buddy;
+    }
+    el_clear_boundary(el_get_footer(block));
+    bytes *= 2;
+    block->size = bytes - EL_BLOCK_OVERHEAD;
+  }
+  block->state = EL_AVAILABLE;
+  el_write_footer(block);
+  el_add_avail(block);
+}
+
+// Divide the space from beg to end, both at offsets from
+// el_buddy_base() that are multiples of EL_BUDDY_MIN, into the largest
+// buddy blocks that fit and make them available
+void el_buddy_carve(void *beg, void *end){
+  void *base = el_buddy_base();
+  size_t off = PTR_MINUS_PTR(beg, base);
+  size_t stop = PTR_MINUS_PTR(end, base);
+  size_t max = EL_BUDDY_MIN << (EL_FL_COUNT-1);
+  while(off < stop){
+    size_t bytes = (off == 0 || (off & -off) > max) ? max : (off & -off);
+    while(bytes > stop - off){
+      bytes /= 2;
+    }
+    el_blockhead_t *block = PTR_PLUS_BYTES(base, off);
+    block->size = bytes - EL_BLOCK_OVERHEAD;
+    el_buddy_release(block);
+    off += bytes;
+  }
+}
+
+// Grow the heap so that a block of the given order can be carved
+// from the new space, which may need up to twice its size for the
+// block to be aligned. Growth follows el_ctl->grow_factor as in
+// el_grow_heap(). Returns 0 on success and 1 if growth is disabled or
+// the pages cannot be mapped.
+int el_buddy_grow(int order){
+  if(el_ctl->grow_factor == 0){
+    return 1;
+  }
+  size_t need = 2*(EL_BUDDY_MIN << order);
+  size_t min_bytes = ((need + EL_PAGE_BYTES - 1) / EL_PAGE_BYTES) * EL_PAGE_BYTES;
+  size_t geo_bytes = el_ctl->heap_bytes * (el_ctl->grow_factor - 1);
+  if(geo_bytes <= min_bytes || el_extend_heap(geo_bytes) != 0){
+    if(el_extend_heap(min_bytes) != 0){
+      return 1;
+    }
+  }
+  el_ctl->grow_count++;
+  return 0;
+}
+
+// Allocate a block with at least nbytes of usable space from the buddy
+// engine and return a pointer to that space. The smallest available
+// block of a large enough order is found through fl_bitmap and split
+// in halves down to the needed order, the upper halves becoming
+// available. The heap is grown if no order is large enough. Returns
+// NULL if no space is available.
+void *el_buddy_malloc(size_t nbytes){
+  if(nbytes > (EL_BUDDY_MIN << (EL_FL_COUNT-2)) - EL_BLOCK_OVERHEAD){
+    return NULL;
+  }
+  int order = el_buddy_order(nbytes + EL_BLOCK_OVERHEAD);
+  size_t orders = el_ctl->fl_bitmap & (~0UL << order);
+  if(orders == 0){
+    if(el_buddy_grow(order) != 0){
+      return NULL;
+    }
+    orders = el_ctl->fl_bitmap & (~0UL << order);
+  }
+  int k = __builtin_ctzl(orders);
+  el_blockhead_t *block = el_ctl->bins[k][0].beg->next;
+  el_remove_avail(block);
+  while(k > order){
+    k--;
+    el_blockhead_t *upper = PTR_PLUS_BYTES(block, EL_BUDDY_MIN << k);
+    upper->size = (EL_BUDDY_MIN << k) - EL_BLOCK_OVERHEAD;
+    upper->state = EL_AVAILABLE;
+    el_write_footer(upper);
+    el_add_avail(upper);
+  }
+  block->size = (EL_BUDDY_MIN << order) - EL_BLOCK_OVERHEAD;
+  block->state = EL_USED;
+  el_write_footer(block);
+  el_add_used(block);
+  el_mark_dirty(block);
+  return PTR_PLUS_BYTES(block, EL_HEAD_BYTES);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// HEAP HANDLE FUNCTIONS
+//
+// Heaps besides the default one are created with el_heap_create() at
+// addresses chosen by the kernel. Each reserves EL_HEAP_RESERVE bytes
+// of address space so that it can grow contiguously. The el_heap_*
+// functions make the given heap el_ctl for the duration of a call and
+// so work with every allocation policy and build option. Blocks must
+// be freed with el_heap_free() on the heap they came from.
+
+// Make heap the el_ctl of the calling thread, locking it when built
+// with EL_THREADSAFE, and return the el_ctl it replaces
+static el_ctl_t *el_enter_heap(el_heap_t *heap){
+  el_ctl_t *saved = el_ctl;
+  el_ctl = heap;
+#ifdef EL_THREADSAFE
+  pthread_mutex_lock(&el_ctl->lock);
+#endif
+  return saved;
+}
+
+// Undo el_enter_heap()
+static void el_leave_heap(el_ctl_t *saved){
+#ifdef EL_THREADSAFE
+  pthread_mutex_unlock(&el_ctl->lock);
+#endif
+  el_ctl = saved;
+}
+
+// Create a new heap of at least initial_bytes, rounded up to whole
+// pages, with the policies given in flags as for el_init_flags(). The
+// control structure and heap are placed by the kernel; the heap may
+// grow to EL_HEAP_RESERVE bytes or initial_bytes if that is
+// larger. Returns NULL if the memory cannot be mapped.
+el_heap_t *el_heap_create(size_t initial_bytes, int flags){
+  size_t heap_bytes = ((initial_bytes + EL_PAGE_BYTES - 1) / EL_PAGE_BYTES) * EL_PAGE_BYTES;
+  if(heap_bytes < EL_PAGE_BYTES){
+    heap_bytes = EL_PAGE_BYTES;
+  }
+  size_t reserve = heap_bytes > EL_HEAP_RESERVE ? heap_bytes : EL_HEAP_RESERVE;
+
+  el_heap_t *heap = mmap(NULL, EL_CTL_BYTES, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if(heap == MAP_FAILED){
+    return NULL;
+  }
+  void *start = mmap(NULL, reserve, PROT_NONE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if(start == MAP_FAILED ||
+     mmap(start, heap_bytes, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+  {
+    if(start != MAP_FAILED) munmap(start, reserve);
+    munmap(heap, EL_CTL_BYTES);
+    return NULL;
+  }
+
+  el_ctl_t *saved = el_ctl;
+  el_ctl = heap;
+  el_init_ctl(start, heap_bytes, PTR_PLUS_BYTES(start, reserve), flags);
+#ifdef EL_THREADSAFE
+  pthread_mutex_init(&heap->lock, NULL);
+#endif
+  el_ctl = saved;
+  return heap;
+}
+
+// Unmap a heap made by el_heap_create() along with every block in it
+void el_heap_destroy(el_heap_t *heap){
+  el_unmap_ctl(heap);
+}
+
+// el_malloc() from the given heap
+void *el_heap_malloc(el_heap_t *heap, size_t nbytes){
+  el_ctl_t *saved = el_enter_heap(heap);
+  void *ptr = el_malloc_unlocked(nbytes);
+  el_leave_heap(saved);
+  return ptr;
+}
+
+// el_free() of a block from the given heap
+void el_heap_free(el_heap_t *heap, void *ptr){
+  el_ctl_t *saved = el_enter_heap(heap);
+  el_free_unlocked(ptr);
+  el_leave_heap(saved);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TRACE RECORDING FUNCTIONS
+//
+// While a trace is recorded el_malloc(), el_calloc(),
+// el_aligned_alloc(), el_realloc(), el_free() and
+// el_append_pages_to_heap() each append an el_trace_rec_t to the
+// trace file so that the allocation pattern of a program can be
+// replayed without it by el_replay. Only calls that succeed are
+// recorded. Heaps made with el_heap_create() are not traced, nor are
+// frees of blocks allocated before the trace began.
+
+// Return the current time in nanoseconds from a monotonic clock
+static uint64_t el_trace_nsecs(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+// Return the slot of the trace table where probing for ptr starts
+static size_t el_trace_home(void *ptr){
+  return (((size_t) ptr >> 4) * 0x9e3779b97f4a7c15) >> 16 & (el_trace.slots-1);
+}
+
+// Add ptr to the trace table with the given ID, doubling the table
+// first if it is half full. Returns 1 if the table cannot grow.
+static int el_trace_insert(void *ptr, uint32_t id){
+  if(2*(el_trace.live+1) > el_trace.slots){
+    void **old_ptrs = el_trace.ptrs;
+    uint32_t *old_ids = el_trace.ids;
+    size_t old_slots = el_trace.slots;
+    void **ptrs = calloc(2*old_slots, sizeof(void *));
+    uint32_t *ids = malloc(2*old_slots * sizeof(uint32_t));
+    if(ptrs == NULL || ids == NULL){
+      free(ptrs);
+      free(ids);
+      return 1;
+    }
+    el_trace.ptrs = ptrs;
+    el_trace.ids = ids;
+    el_trace.slots = 2*old_slots;
+    el_trace.live = 0;
+    for(size_t i=0; i<old_slots; i++){
+      if(old_ptrs[i] != NULL){
+        el_trace_insert(old_ptrs[i], old_ids[i]);
+      }
+    }
+    free(old_ptrs);
+    free(old_ids);
+  }
+  size_t i = el_trace_home(ptr);
+  while(el_trace.ptrs[i] != NULL){
+    i = (i+1) & (el_trace.slots-1);
+  }
+  el_trace.ptrs[i] = ptr;
+  el_trace.ids[i] = id;
+  el_trace.live++;
+  return 0;
+}
+
+// Remove ptr from the trace table and return its ID, or 0 if it is
+// not there. Later pointers of the same probe run are shifted back so
+// that none is separated from its home slot by an empty one.
+static uint32_t el_trace_remove(void *ptr){
+  size_t mask = el_trace.slots-1;
+  size_t i = el_trace_home(ptr);
+  while(el_trace.ptrs[i] != ptr){
+    if(el_trace.ptrs[i] == NULL){
+      return 0;
+    }
+    i = (i+1) & mask;
+  }
+  uint32_t id = el_trace.ids[i];
+  el_trace.ptrs[i] = NULL;
+  el_trace.live--;
+  for(size_t j=(i+1) & mask; el_trace.ptrs[j] != NULL; j=(j+1) & mask){
+    size_t home = el_trace_home(el_trace.ptrs[j]);
+    if(((j - home) & mask) >= ((j - i) & mask)){
+      el_trace.ptrs[i] = el_trace.ptrs[j];
+      el_trace.ids[i] = el_trace.ids[j];
+      el_trace.ptrs[j] = NULL;
+      i = j;
+    }
+  }
+  return id;
+}
+
+// Remove ptr, which is about to be freed or resized, from the trace
+// table and return its ID or 0 if it was allocated before the trace
+// began
+static uint32_t el_trace_forget(void *ptr){
+#ifdef EL_THREADSAFE
+  pthread_mutex_lock(&el_trace.lock);
+#endif
+  uint32_t id = el_trace.file != NULL ? el_trace_remove(ptr) : 0;
+#ifdef EL_THREADSAFE
+  pthread_mutex_unlock(&el_trace.lock);
+#endif
+  return id;
+}
+
+// Put back ptr with the ID el_trace_forget() returned for it when the
+// el_realloc() that was to resize it fails and leaves it in place.
+// Nothing is written as the failed call changed nothing to replay.
+static void el_trace_restore(void *ptr, uint32_t id){
+#ifdef EL_THREADSAFE
+  pthread_mutex_lock(&el_trace.lock);
+#endif
+  if(el_trace.file != NULL && id != 0 && el_trace_insert(ptr, id) != 0){
+    fprintf(stderr, "ERROR: Unable to grow trace table, trace ends\n");
+    el_trace_end();
+  }
+#ifdef EL_THREADSAFE
+  pthread_mutex_unlock(&el_trace.lock);
+#endif
+}
+
+// Record an operation of size bytes that left the pointer with the
+// given ID at ptr, which is NULL if it was freed. An ID of 0 gives a
+// newly allocated ptr the next ID. Nothing is written for a failed
+// call or one on a pointer the trace does not know.
+static void el_trace_record(int op, uint32_t id, void *ptr, size_t size, size_t align){
+#ifdef EL_THREADSAFE
+  pthread_mutex_lock(&el_trace.lock);
+#endif
+  if(el_trace.file != NULL){
+    if(ptr != NULL && id == 0){
+      id = el_trace.next_id++;
+    }
+    if(ptr != NULL && id != 0 && el_trace_insert(ptr, id) != 0){
+      fprintf(stderr, "ERROR: Unable to grow trace table, trace ends\n");
+      el_trace_end();
+    }
+    else if(id != 0 || op == EL_TRACE_APPEND){
+      el_trace_rec_t rec = {
+        .nsecs = el_trace_nsecs() - el_trace.beg_nsecs,
+        .size = size,
+        .id = id,
+        .op = op,
+        .align_log2 = align > 0 ? __builtin_ctzl(align) : 0,
+      };
+      fwrite(&rec, sizeof(rec), 1, el_trace.file);
+    }
+  }
+#ifdef EL_THREADSAFE
+  pthread_mutex_unlock(&el_trace.lock);
+#endif
+}
+
+// Begin recording a trace of allocations to the file at path, which
+// is replaced. The file starts with an el_trace_head_t holding the
+// flags of el_ctl. Returns 1 if a trace is already being recorded or
+// the file cannot be written and 0 otherwise.
+int el_trace_begin(const char *path){
+  if(el_trace.file != NULL){
+    return 1;
+  }
+  FILE *file = fopen(path, "wb");
+  if(file == NULL){
+    return 1;
+  }
+  el_trace_head_t head = { .flags = el_ctl != NULL ? el_ctl->flags : 0 };
+  memcpy(head.magic, EL_TRACE_MAGIC, sizeof(head.magic));
+  el_trace.slots = 1024;
+  el_trace.ptrs = calloc(el_trace.slots, sizeof(void *));
+  el_trace.ids = malloc(el_trace.slots * sizeof(uint32_t));
+  if(el_trace.ptrs == NULL || el_trace.ids == NULL ||
+     fwrite(&head, sizeof(head), 1, file) != 1)
+  {
+    free(el_trace.ptrs);
+    free(el_trace.ids);
+    fclose(file);
+    return 1;
+  }
+  el_trace.live = 0;
+  el_trace.next_id = 1;
+  el_trace.beg_nsecs = el_trace_nsecs();
+  el_trace.file = file;
+  return 0;
+}
+
+// Finish the trace being recorded, if any, and close its file
+void el_trace_end(){
+  if(el_trace.file == NULL){
+    return;
+  }
+  fclose(el_trace.file);
+  el_trace.file = NULL;
+  free(el_trace.ptrs);
+  free(el_trace.ids);
+  el_trace.ptrs = NULL;
+  el_trace.ids = NULL;
 }
@@ -7,6 +7,9 @@
 #include <stdint.h>
 #include <sys/mman.h>
 #include <assert.h>
+#ifdef EL_THREADSAFE
+#include <pthread.h>
+#endif
 
 // macro to add a byte offset to a pointer, arguments are a pointer
 // and a # of bytes (usually size_t)
@@ -25,10 +28,55 @@
 #define EL_CTL_START_ADDRESS  ((void *) 0x0000610000000000)
 #define EL_HEAP_START_ADDRESS ((void *) 0x0000612000000000)
 #define EL_HEAP_INITIAL_SIZE  ((size_t) EL_PAGE_BYTES)
+#define EL_HEAP_RESERVE  ((size_t) 1 << 32) // address space reserved by el_heap_create() for growth
+#define EL_GROW_FACTOR   2      // default el_ctl->grow_factor for automatic heap growth
+#define EL_TRIM_THRESHOLD ((size_t) 128*1024) // default el_ctl->trim_threshold for automatic trimming
+#define EL_MMAP_THRESHOLD ((size_t) 1024*1024) // default el_ctl->mmap_threshold for blocks given their own mapping
+#define EL_QUICK_THRESHOLD 256  // default el_ctl->quick_threshold of deferred blocks that triggers coalescing
+#define EL_QUICK_CLASSES 32     // number of smallest block sizes kept on quick lists with EL_DEFERRED
+#define EL_ALIGNMENT     16     // alignment of every pointer returned by el_malloc()
+#define EL_REGION_CHUNK  ((size_t) 64*1024) // bytes region allocation takes from the heap at a time
+#define EL_SLAB_BYTES    ((size_t) EL_PAGE_BYTES) // size and alignment of each slab of a slab cache
+#define EL_SLAB_MIN_OBJECTS 4   // fewest objects a slab may hold
+
+// Arenas used when built with EL_THREADSAFE. Arena i has its control
+// structure EL_CTL_BYTES after arena i-1 and its heap EL_ARENA_SPAN
+// bytes after that of arena i-1.
+#define EL_ARENA_COUNT   8      // number of arenas threads are spread across
+#define EL_ARENA_SPAN    ((size_t) 1 << 36) // address space reserved for each arena's heap
+#define EL_TCACHE_CLASSES 32    // number of smallest block sizes kept in per-thread caches
+#define EL_TCACHE_COUNT  16     // blocks of each size a thread cache holds
+
+// Flags passed to el_init_flags() to select allocation policies; the
+// default of 0 is a single available list searched first-fit.
+#define EL_SEGREGATED    0x01   // keep available blocks in two-level segregated fit (TLSF) bins
+#define EL_BUDDY         0x02   // binary buddy engine; takes precedence over the others
+#define EL_BEST_FIT      0x04   // keep available blocks in a tree searched best-fit; takes precedence over EL_SEGREGATED
+#define EL_ADDRESS_ORDER 0x08   // keep available blocks in a tree by address searched first-fit; takes precedence over EL_SEGREGATED
+#define EL_NEXT_FIT      0x10   // search the available list from where the last search stopped; list engine only
+#define EL_DEFERRED      0x20   // keep small freed blocks on quick lists and coalesce them later in batches; not with EL_BUDDY
+
+// Geometry of the buddy engine. Blocks are EL_BUDDY_MIN bytes shifted
+// left by their order, including overhead, and sit at an offset from
+// the first block that is a multiple of their size. Free blocks of
+// order k are kept in bins[k][0] with bit k of fl_bitmap set when
+// that list is non-empty.
+#define EL_BUDDY_MIN_LOG2 5
+#define EL_BUDDY_MIN     ((size_t) 1 << EL_BUDDY_MIN_LOG2) // smallest buddy block
+
+// Geometry of the size-class bins used with EL_SEGREGATED. The first
+// level splits sizes by their highest set bit; each first-level class
+// is divided into EL_SL_COUNT equal second-level bins. Sizes below
+// EL_SL_COUNT all share first-level class 0.
+#define EL_FL_COUNT      40     // number of first-level size classes
+#define EL_SL_LOG2       3      // log2 of the number of second-level bins
+#define EL_SL_COUNT      (1 << EL_SL_LOG2)
 
 // defines to indicate if a block is available or used
 #define EL_AVAILABLE     'a'    // block state indicating available
 #define EL_USED          'u'    // block state indicating in use
+#define EL_MAPPED        'm'    // block state indicating in use in a mapping of its own
+#define EL_QUICK         'q'    // block state indicating freed but waiting on a quick list to be coalesced
 #define EL_BEGIN_BLOCK   'B'    // block state indicating dummy beginning node in a list
 #define EL_END_BLOCK     'E'    // block state indicating dummy ending node in a list
 #define EL_UNINITIALIZED  0     // indication of uninitialized data
@@ -38,25 +86,82 @@
 // next/prev blocks in a doubly linked list. This data structure
 // appears immediately before a block of memory that is tracked by the
 // allocator.
+#ifndef EL_COMPACT_HEADERS
 typedef struct block {
   size_t size;                  // number of bytes of memory in this block
   char state;                   // either EL_AVAILABLE or EL_USED
-  struct block *next;           // pointer to next block in same list
-  struct block *prev;           // pointer to previous block in same list
+  unsigned char height;         // height of the tree under an available block with EL_BEST_FIT or EL_ADDRESS_ORDER
+  unsigned int fit;             // largest size in that tree rounded up by el_fit_code()
+  struct block *next;           // pointer to next block in same list; left child in a tree
+  struct block *prev;           // pointer to previous block in same list; right child in a tree
 } el_blockhead_t;
+#else
+// With EL_COMPACT_HEADERS defined at compile time the header is a
+// single word: the state and a flag telling whether the block below
+// is available are packed into the low bits beside the size. The
+// next/prev links exist only while a block is available and overlay
+// the start of its usable space; used blocks are not linked into any
+// list. The largest size in the tree under an available block is kept
+// in its footer as there is no room for it here.
+typedef struct block {
+  size_t state     : 7;         // either EL_AVAILABLE or EL_USED
+  size_t prev_free : 1;         // 1 if the block below is available and so has a footer
+  size_t height    : 6;         // height of the tree under an available block with EL_BEST_FIT or EL_ADDRESS_ORDER
+  size_t size      : 44;        // number of bytes of memory in this block
+  struct block *next;           // pointer to next block in same list; available blocks only
+  struct block *prev;           // pointer to previous block in same list; available blocks only
+} el_blockhead_t;
+#endif
 
 // Type for the "footer" of a block; indicates size of the preceding
 // block so that its header el_blockhead_t can be found with pointer
 // arithmetic. This data appears immediately after an area of memory
 // that may be used by a user or is free. Immediately after it is
-// either another header (el_blockhead_t) or the end of the heap.
+// either another header (el_blockhead_t) or the end of the heap. With
+// EL_COMPACT_HEADERS only available blocks have a footer which
+// occupies the last bytes of their usable space and also holds the
+// fit of the block that the header has no room for.
+#ifndef EL_COMPACT_HEADERS
 typedef struct {
   size_t size;
 } el_blockfoot_t;
+#else
+typedef struct {
+  size_t size      : 44;        // number of bytes of memory in the block
+  size_t fit       : 20;        // largest size in the tree under the block rounded up by el_fit_code()
+} el_blockfoot_t;
+#endif
 
+#ifndef EL_COMPACT_HEADERS
 // Size of tracking data for each block of data allocated which is a
 // combination of the size of the header and footer.
 #define EL_BLOCK_OVERHEAD (sizeof(el_blockhead_t) + sizeof(el_blockfoot_t))
+#define EL_HEAD_BYTES     sizeof(el_blockhead_t) // bytes from a header to its usable space
+#define EL_MIN_SIZE       0     // smallest usable space a block may have
+#define EL_MAX_SIZE       (SIZE_MAX - EL_BLOCK_OVERHEAD - EL_ALIGNMENT) // largest request that can be rounded
+#define EL_HEAP_PAD       0     // bytes unused at each end of the heap
+#else
+// Only the size word is overhead. Available blocks need room for
+// their links and footer so blocks are never smaller than that. The
+// first header sits EL_HEAP_PAD bytes into the heap so usable space
+// stays EL_ALIGNMENT aligned; the last EL_HEAP_PAD bytes of the heap
+// hold a fence header whose prev_free flag tracks the top block.
+#define EL_BLOCK_OVERHEAD sizeof(size_t)
+#define EL_HEAD_BYTES     sizeof(size_t)
+#define EL_MIN_SIZE       (2*sizeof(el_blockhead_t *) + sizeof(el_blockfoot_t))
+#define EL_MAX_SIZE       (((size_t) 1 << 44) - EL_BLOCK_OVERHEAD - EL_ALIGNMENT) // largest size the header holds
+#define EL_HEAP_PAD       8
+#define EL_WIDE_OVERHEAD  (4*sizeof(size_t) + sizeof(el_blockfoot_t)) // overhead without EL_COMPACT_HEADERS
+#endif
+
+// With EL_NO_USED_LIST defined at compile time used blocks are known
+// only by their state: el_malloc() and el_free() keep just the length
+// and bytes of el_ctl->used and the used blocks are found by a walk
+// through the heap when printed. EL_COMPACT_HEADERS implies it as used
+// blocks have no links there.
+#if defined(EL_COMPACT_HEADERS) && !defined(EL_NO_USED_LIST)
+#define EL_NO_USED_LIST
+#endif
 
 // Type for a list of blocks; doubly linked with a fixed
 // "dummy" node at the beginning and end which do not contain any
@@ -71,6 +176,22 @@ typedef struct {
 } el_blocklist_t;
 // NOTE: total available bytes for use/in-use in the list is (bytes - length*EL_BLOCK_OVERHEAD)
 
+// Type for the start of an anonymous mapping made for a single large
+// block outside the heap. Mappings are doubly linked from the mapped
+// list of the control that made them. The block header sits at the
+// end of the first EL_MAP_OFFSET bytes with state EL_MAPPED so that
+// el_free() can tell a mapped block from a heap block.
+typedef struct el_map {
+  struct el_map *next;          // next mapping in the same list
+  struct el_map *prev;          // previous mapping in the same list
+  void *ctl;                    // control whose mapped list holds this mapping
+  size_t bytes;                 // bytes mapped including this header
+} el_map_t;
+
+// Bytes from the start of a mapping to the usable space of its block
+#define EL_MAP_OFFSET \
+  (((sizeof(el_map_t) + EL_HEAD_BYTES + EL_ALIGNMENT - 1) / EL_ALIGNMENT) * EL_ALIGNMENT)
+
 // Type for the global control of the allocator. Tracks heap size,
 // start and end addresses, total size, and lists of available and
 // used blocks.
@@ -82,33 +203,194 @@ typedef struct {
   el_blocklist_t used_actual;   // space for the used list data
   el_blocklist_t *avail;        // pointer to avail_actual
   el_blocklist_t *used;         // pointer to used_actual
+  int flags;                    // policy flags given to el_init_flags()
+  el_blocklist_t bins[EL_FL_COUNT][EL_SL_COUNT]; // size-class bins of available blocks with EL_SEGREGATED
+  size_t fl_bitmap;             // bit i set when first-level class i has a non-empty bin
+  unsigned int sl_bitmap[EL_FL_COUNT]; // bit j of entry i set when bins[i][j] is non-empty
+  el_blockhead_t *avail_tree;   // root of the AVL tree of available blocks with EL_BEST_FIT or EL_ADDRESS_ORDER
+  el_blockhead_t *rover;        // block the next search of the available list starts at with EL_NEXT_FIT; NULL for its start
+  size_t search_count;          // number of searches of the available list
+  size_t search_steps;          // number of blocks examined by those searches
+  el_blockhead_t *quick[EL_QUICK_CLASSES]; // freed blocks of each small size awaiting coalescing with EL_DEFERRED
+  size_t quick_count;           // number of blocks on the quick lists
+  size_t quick_bytes;           // total bytes of blocks on the quick lists including overhead
+  size_t quick_threshold;       // el_free() coalesces the quick lists when they hold more blocks than this
+  size_t consolidations;        // number of times the quick lists have been coalesced
+  size_t grow_factor;           // el_malloc() grows the heap to at least this times its size; 0 disables growth
+  size_t grow_count;            // number of times el_malloc() has grown the heap
+  size_t trim_threshold;        // el_free() trims the heap when its top free block exceeds this, raised by growth; 0 disables
+  size_t released_bytes;        // total bytes returned to the OS by trimming
+  void *zero_start;             // heap memory at or above this address has never been given to a user
+  void *heap_limit;             // end of address space reserved for the heap to grow into; NULL if none
+  size_t mmap_threshold;        // el_malloc() gives blocks of at least this size their own mapping; 0 disables
+  el_map_t *mapped;             // mappings holding large blocks, most recent first
+  size_t mapped_count;          // number of mappings in the mapped list
+  size_t mapped_bytes;          // total bytes of the mappings in the mapped list
+#ifdef EL_THREADSAFE
+  pthread_mutex_t lock;         // held by a thread working on this arena
+  size_t tcache_hits;           // el_malloc() calls served by thread caches as of their last lock of the arena
+  size_t tcache_misses;         // el_malloc() calls of cached sizes those caches could not serve
+  void *remote_free;            // stack of blocks freed by other threads, linked through their first word
+  size_t remote_frees;          // number of blocks freed from the remote free stack
+#endif
 } el_ctl_t;
 
-// global control declared in el_malloc.c
+// A heap made with el_heap_create() is known by its control structure
+typedef el_ctl_t el_heap_t;
+
+// Type for a region made with el_region_begin(). Objects are carved
+// from a list of chunks allocated with el_malloc() by advancing next
+// towards end. The region itself sits at the start of its first chunk.
+typedef struct {
+  struct el_chunk *chunks;      // most recent chunk; each links to the one before it
+  void *next;                   // next free byte of the most recent chunk
+  void *end;                    // end of the most recent chunk
+  size_t bytes;                 // bytes allocated from the region since it was last reset
+} el_region_t;
+
+// Type for a cache of fixed-size objects made with el_slab_create().
+// Slabs with free slots are on the partial list and those without on
+// the full list. On an EL_BUDDY heap each slab is a page mapped for it
+// alone with its header after that of the mapping.
+typedef struct {
+  size_t object_size;           // bytes requested for each object
+  size_t align;                 // alignment of each object
+  size_t stride;                // distance between objects in a slab
+  size_t capacity;              // objects held by each slab
+  size_t offset;                // bytes from the EL_SLAB_BYTES boundary of each slab to its header
+  struct el_slab *partial;      // slabs with at least one free slot
+  struct el_slab *full;         // slabs with no free slots
+  size_t slab_count;            // slabs on both lists
+} el_slab_cache_t;
+
+// Operations recorded in an allocation trace by el_trace_begin()
+#define EL_TRACE_MAGIC   "ELTRACE1" // first bytes of every trace file
+#define EL_TRACE_MALLOC  'm'    // el_malloc() of size bytes
+#define EL_TRACE_CALLOC  'c'    // el_calloc() of size bytes in all
+#define EL_TRACE_ALIGNED 'l'    // el_aligned_alloc() of size bytes aligned to 1 << align_log2
+#define EL_TRACE_REALLOC 'r'    // el_realloc() to size bytes, freeing the pointer if 0
+#define EL_TRACE_FREE    'f'    // el_free()
+#define EL_TRACE_APPEND  'p'    // el_append_pages_to_heap() of size pages
+
+// Type for the start of a trace file; el_trace_rec_t records follow
+// it to the end of the file
+typedef struct {
+  char magic[8];                // EL_TRACE_MAGIC without its terminating 0
+  uint64_t flags;               // el_ctl->flags when the trace began
+} el_trace_head_t;
+
+// Type for one operation in a trace file. Pointers are given IDs
+// from 1 in the order they are allocated and keep them through
+// el_realloc() so a trace can be replayed at any addresses.
+typedef struct {
+  uint64_t nsecs;               // nanoseconds from the start of the trace to the operation
+  uint64_t size;                // bytes requested, or pages appended for EL_TRACE_APPEND
+  uint32_t id;                  // ID of the pointer allocated, resized, or freed; 0 for EL_TRACE_APPEND
+  uint16_t op;                  // one of the EL_TRACE_ operations
+  uint16_t align_log2;          // log2 of the alignment of EL_TRACE_ALIGNED
+} el_trace_rec_t;
+
+// Bytes mapped for the control structure, rounded up to whole pages
+#define EL_CTL_BYTES \
+  (((sizeof(el_ctl_t) + EL_PAGE_BYTES - 1) / EL_PAGE_BYTES) * EL_PAGE_BYTES)
+
+// global control declared in el_malloc.c; each thread has its own
+// when built with EL_THREADSAFE
+#ifdef EL_THREADSAFE
+extern __thread el_ctl_t *el_ctl;
+#else
 extern el_ctl_t *el_ctl;
+#endif
 
 // functions in el_malloc.c
 int  el_init();
+int  el_init_flags(int flags);
+int  el_init_arena(void *ctl_addr, void *heap_addr, int flags);
+int  el_init_ctl(void *heap, size_t heap_bytes, void *heap_limit, int flags);
 void el_print_stats();
 void el_cleanup();
+#ifdef EL_THREADSAFE
+el_ctl_t *el_arena(int i);
+el_ctl_t *el_arena_of(void *ptr);
+#endif
 
 el_blockfoot_t *el_get_footer(el_blockhead_t *block);
 el_blockhead_t *el_get_header(el_blockfoot_t *foot);
 el_blockhead_t *el_block_above(el_blockhead_t *block);
 el_blockhead_t *el_block_below(el_blockhead_t *block);
+el_blockhead_t *el_top_avail();
+el_map_t *el_map_of(el_blockhead_t *block);
+void el_write_footer(el_blockhead_t *block);
 
 void el_init_blocklist(el_blocklist_t *list);
 void el_print_blocklist(el_blocklist_t *list);
 void el_add_block_front(el_blocklist_t *list, el_blockhead_t *block);
 void el_remove_block(el_blocklist_t *list, el_blockhead_t *block);
 
+void el_bin_index(size_t size, int *fl, int *sl);
+el_blocklist_t *el_avail_list(size_t size);
+el_blockhead_t *el_tree_insert(el_blockhead_t *root, el_blockhead_t *block);
+el_blockhead_t *el_tree_remove(el_blockhead_t *root, el_blockhead_t *block);
+el_blockhead_t *el_tree_find(size_t size);
+void el_print_tree();
+void el_add_avail(el_blockhead_t *block);
+void el_remove_avail(el_blockhead_t *block);
+void el_add_used(el_blockhead_t *block);
+void el_remove_used(el_blockhead_t *block);
+
 el_blockhead_t *el_find_first_avail(size_t size);
 el_blockhead_t *el_split_block(el_blockhead_t *block, size_t new_size);
 el_blockhead_t *el_allocate_block(size_t size);
+size_t el_round_size(size_t nbytes);
 void *el_malloc(size_t nbytes);
+void *el_aligned_alloc(size_t alignment, size_t nbytes);
+void *el_calloc(size_t nmemb, size_t size);
+void el_mark_dirty(el_blockhead_t *block);
+void el_clear_boundary(el_blockfoot_t *foot);
 
 void el_merge_block_with_above(el_blockhead_t *lower);
+void el_consolidate();
 void el_free(void *ptr);
 
+void *el_realloc(void *ptr, size_t nbytes);
+
+void *el_map_alloc(size_t size);
+void *el_map_malloc(size_t nbytes);
+void el_map_free(el_blockhead_t *block);
+void *el_map_resize(el_blockhead_t *block, size_t size);
+
+void *el_buddy_base();
+void *el_buddy_end();
+int el_buddy_order(size_t bytes);
+void el_buddy_release(el_blockhead_t *block);
+void el_buddy_carve(void *beg, void *end);
+int el_buddy_grow(int order);
+void *el_buddy_malloc(size_t nbytes);
+
 int el_append_pages_to_heap(int npages);
+el_blockhead_t *el_grow_heap(size_t size);
+
+size_t el_trim_top(size_t keep_bytes);
+size_t el_trim(size_t keep_bytes);
+
+el_heap_t *el_heap_create(size_t initial_bytes, int flags);
+void el_heap_destroy(el_heap_t *heap);
+void *el_heap_malloc(el_heap_t *heap, size_t nbytes);
+void el_heap_free(el_heap_t *heap, void *ptr);
+
+int  el_trace_begin(const char *path);
+void el_trace_end();
+
+// functions in el_region.c
+el_region_t *el_region_begin();
+void *el_region_alloc(el_region_t *region, size_t nbytes);
+void el_region_reset(el_region_t *region);
+void el_region_end(el_region_t *region);
+
+// functions in el_slab.c
+el_slab_cache_t *el_slab_create(size_t object_size, size_t align);
+void *el_slab_alloc(el_slab_cache_t *cache);
+void el_slab_free(el_slab_cache_t *cache, void *ptr);
+void el_slab_destroy(el_slab_cache_t *cache);
+void el_slab_print_stats(el_slab_cache_t *cache);
 #endif
@@ -0,0 +1,850 @@
+// el_malloc_benchmark.c: timing of el_malloc() under different
+// allocation policies. Run with no arguments to run all benchmarks or
+// name individual benchmarks on the command line. An initial -j
+// prints the results of the glibc benchmark as JSON for regression
+// tracking and runs only it unless others are named.
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "el_malloc.h"
+
+// Return the current time in nanoseconds from a monotonic clock
+double now_nsecs(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// Append enough pages to the heap to hold the given number of bytes
+void reserve_heap(size_t bytes){
+  int npages = bytes / EL_PAGE_BYTES + 1;
+  if(el_append_pages_to_heap(npages) != 0){
+    printf("unable to reserve %lu bytes of heap\n",bytes);
+    exit(1);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// freelist: malloc() latency as the available list grows
+
+#define FRAG_SIZE   24          // size of small fragments left in the free list
+#define BIG_SIZE    1024        // size of the blocks requested during timing
+#define BIG_COUNT   1000        // number of big blocks requested per measurement
+
+// Fragment the heap into nfrags small available blocks separated by
+// used spacers so they cannot merge, behind which sit BIG_COUNT free
+// blocks of BIG_SIZE. Times BIG_COUNT el_malloc(BIG_SIZE) calls and
+// returns the average nanoseconds per call. The average number of
+// available blocks examined per call is stored in steps. With a single
+// first-fit list each call must walk past all the fragments; next fit
+// walks past them once and then resumes behind them.
+double time_freelist(int flags, int nfrags, double *steps){
+  el_init_flags(flags);
+  reserve_heap((size_t) (nfrags + BIG_COUNT) *
+               (FRAG_SIZE + BIG_SIZE + 4*EL_BLOCK_OVERHEAD));
+
+  void **frags = malloc(nfrags * sizeof(void *));
+  void **bigs  = malloc(BIG_COUNT * sizeof(void *));
+  for(int i=0; i<nfrags; i++){
+    frags[i] = el_malloc(FRAG_SIZE);
+    el_malloc(FRAG_SIZE);                   // spacer
+  }
+  for(int i=0; i<BIG_COUNT; i++){
+    bigs[i] = el_malloc(BIG_SIZE);
+    el_malloc(FRAG_SIZE);                   // spacer
+  }
+
+  // free big blocks first so that fragments end up ahead of them in
+  // the available list
+  for(int i=0; i<BIG_COUNT; i++){
+    el_free(bigs[i]);
+  }
+  for(int i=0; i<nfrags; i++){
+    el_free(frags[i]);
+  }
+
+  size_t steps_beg = el_ctl->search_steps;
+  double beg = now_nsecs();
+  for(int i=0; i<BIG_COUNT; i++){
+    bigs[i] = el_malloc(BIG_SIZE);
+  }
+  double end = now_nsecs();
+  *steps = (double) (el_ctl->search_steps - steps_beg) / BIG_COUNT;
+
+  free(frags);
+  free(bigs);
+  el_cleanup();
+  return (end-beg) / BIG_COUNT;
+}
+
+void bench_freelist(){
+  printf("==== freelist: el_malloc(%d) latency vs free list length ====\n",BIG_SIZE);
+  printf("%8s %14s %10s %14s %10s %14s\n","length","first-fit ns","steps",
+         "next-fit ns","steps","segregated ns");
+  for(int nfrags=1000; nfrags<=64000; nfrags*=2){
+    double ff_steps, nf_steps, seg_steps;
+    double ff  = time_freelist(0, nfrags, &ff_steps);
+    double nf  = time_freelist(EL_NEXT_FIT, nfrags, &nf_steps);
+    double seg = time_freelist(EL_SEGREGATED, nfrags, &seg_steps);
+    printf("%8d %14.1f %10.1f %14.1f %10.1f %14.1f\n",nfrags,ff,ff_steps,nf,nf_steps,seg);
+  }
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// growth: number of heap growths under automatic growth
+
+#define GROWTH_ALLOCS  (1 << 20)  // number of allocations made
+
+// Allocates GROWTH_ALLOCS blocks of random sizes with automatic heap
+// growth using the given grow factor and reports how many times the
+// heap had to grow along with the elapsed time.
+void time_growth(size_t factor){
+  el_init();
+  el_ctl->grow_factor = factor;
+  srand(216);
+  double beg = now_nsecs();
+  for(int i=0; i<GROWTH_ALLOCS; i++){
+    el_malloc(16 + rand() % 240);
+  }
+  double end = now_nsecs();
+  printf("%8lu %12lu %14lu %10.1f\n",
+         factor, el_ctl->grow_count, el_ctl->heap_bytes, (end-beg)/1e6);
+  el_cleanup();
+}
+
+void bench_growth(){
+  printf("==== growth: heap growths for %d allocations ====\n",GROWTH_ALLOCS);
+  printf("%8s %12s %14s %10s\n","factor","grow_count","heap_bytes","msecs");
+  time_growth(1);
+  time_growth(2);
+  time_growth(4);
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// realloc: vector-style doubling growth
+
+#define VEC_PUSHES  (1 << 20)   // total elements pushed across all vectors
+#define VEC_NOISE   16          // a small allocation is made every this many pushes
+
+// Pushes VEC_PUSHES longs round-robin onto nvecs vectors which double
+// their capacity when full, interleaved with small allocations that
+// are never freed. If naive is nonzero growth always allocates a new
+// buffer, copies, and frees the old one; otherwise el_realloc() is
+// used. Reports the number of copies, bytes copied, and time. Moving
+// a block which already has its own mapping is done by mremap()
+// without copying so is not counted.
+void time_realloc(int naive, int nvecs){
+  el_init();
+  long **vecs = malloc(nvecs * sizeof(long *));
+  size_t *caps = malloc(nvecs * sizeof(size_t));
+  size_t *lens = malloc(nvecs * sizeof(size_t));
+  for(int v=0; v<nvecs; v++){
+    caps[v] = 4;
+    lens[v] = 0;
+    vecs[v] = el_malloc(caps[v] * sizeof(long));
+  }
+
+  long copies = 0;
+  size_t copied = 0;
+  double beg = now_nsecs();
+  for(int i=0; i<VEC_PUSHES; i++){
+    int v = i % nvecs;
+    if(lens[v] == caps[v]){
+      size_t old_bytes = caps[v] * sizeof(long);
+      caps[v] *= 2;
+      long *grown;
+      el_blockhead_t *block = PTR_MINUS_BYTES(vecs[v], EL_HEAD_BYTES);
+      int remapped = !naive && block->state == EL_MAPPED;
+      if(naive){
+        grown = el_malloc(caps[v] * sizeof(long));
+        memcpy(grown, vecs[v], old_bytes);
+        el_free(vecs[v]);
+      }
+      else{
+        grown = el_realloc(vecs[v], caps[v] * sizeof(long));
+      }
+      if(naive || (grown != vecs[v] && !remapped)){
+        copies++;
+        copied += old_bytes;
+      }
+      vecs[v] = grown;
+    }
+    vecs[v][lens[v]++] = i;
+    if(i % VEC_NOISE == 0){
+      el_malloc(24);
+    }
+  }
+  double end = now_nsecs();
+
+  printf("%8d %12s %10ld %14lu %14lu %10.1f\n",
+         nvecs, naive ? "naive" : "el_realloc", copies, copied,
+         el_ctl->heap_bytes, (end-beg)/1e6);
+  free(vecs);
+  free(caps);
+  free(lens);
+  el_cleanup();
+}
+
+void bench_realloc(){
+  printf("==== realloc: vector doubling with %d pushes ====\n",VEC_PUSHES);
+  printf("%8s %12s %10s %14s %14s %10s\n",
+         "vectors","method","copies","bytes_copied","heap_bytes","msecs");
+  for(int nvecs=1; nvecs<=16; nvecs*=4){
+    time_realloc(1, nvecs);
+    time_realloc(0, nvecs);
+  }
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// calloc: zeroing of fresh versus reused memory
+
+// Return the number of minor page faults taken by this process so far
+long minor_faults(){
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_minflt;
+}
+
+// Allocates a zeroed block of nbytes on a fresh heap with el_calloc()
+// and with el_malloc()+memset(), then frees the el_calloc() block and
+// allocates it again so that it must be cleared. A small block behind
+// it keeps the freed block from being trimmed back to the OS. Reports
+// time and the page faults taken by each. Blocks are kept in the heap
+// rather than given mappings of their own to time heap zeroing.
+void time_calloc(size_t nbytes){
+  el_init();
+  el_ctl->mmap_threshold = 0;
+  long faults = minor_faults();
+  double beg = now_nsecs();
+  void *fresh = el_calloc(1, nbytes);
+  double end = now_nsecs();
+  printf("%10lu %14s %10.3f %10ld\n", nbytes, "calloc fresh", (end-beg)/1e6, minor_faults()-faults);
+  memset(fresh, 0xff, nbytes);
+  el_malloc(FRAG_SIZE);                     // spacer
+
+  el_free(fresh);
+  faults = minor_faults();
+  beg = now_nsecs();
+  void *reused = el_calloc(1, nbytes);
+  end = now_nsecs();
+  printf("%10lu %14s %10.3f %10ld\n", nbytes, "calloc reused", (end-beg)/1e6, minor_faults()-faults);
+  el_free(reused);
+  el_cleanup();
+
+  el_init();
+  el_ctl->mmap_threshold = 0;
+  faults = minor_faults();
+  beg = now_nsecs();
+  void *manual = el_malloc(nbytes);
+  memset(manual, 0, nbytes);
+  end = now_nsecs();
+  printf("%10lu %14s %10.3f %10ld\n", nbytes, "malloc+memset", (end-beg)/1e6, minor_faults()-faults);
+  el_cleanup();
+}
+
+void bench_calloc(){
+  printf("==== calloc: zeroing large blocks ====\n");
+  printf("%10s %14s %10s %10s\n","bytes","method","msecs","faults");
+  for(size_t nbytes=1<<20; nbytes<=(1<<26); nbytes*=8){
+    time_calloc(nbytes);
+  }
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// region: short-lived request objects freed one by one versus reset
+
+#define REQUESTS     (1 << 14)  // requests handled
+#define REQUEST_OBJS 300        // objects allocated while handling each request
+
+// Handles REQUESTS requests each of which allocates REQUEST_OBJS
+// objects of random sizes and touches them, then releases them all
+// when the request ends. If use_region is nonzero the objects come
+// from a region which is reset after each request; otherwise each is
+// allocated with el_malloc() and freed with el_free(). Reports the
+// time and peak heap size.
+void time_region(int use_region){
+  el_init();
+  void **objs = malloc(REQUEST_OBJS * sizeof(void *));
+  el_region_t *region = use_region ? el_region_begin() : NULL;
+  srand(216);
+  double beg = now_nsecs();
+  for(int r=0; r<REQUESTS; r++){
+    for(int i=0; i<REQUEST_OBJS; i++){
+      size_t size = 16 + rand() % 240;
+      objs[i] = use_region ? el_region_alloc(region, size) : el_malloc(size);
+      memset(objs[i], r, size);
+    }
+    if(use_region){
+      el_region_reset(region);
+    }
+    else{
+      for(int i=0; i<REQUEST_OBJS; i++){
+        el_free(objs[i]);
+      }
+    }
+  }
+  double end = now_nsecs();
+  printf("%12s %14lu %10.1f %12.1f\n",
+         use_region ? "region" : "el_free", el_ctl->heap_bytes, (end-beg)/1e6,
+         (end-beg)/((double) REQUESTS*REQUEST_OBJS));
+  if(use_region){
+    el_region_end(region);
+  }
+  free(objs);
+  el_cleanup();
+}
+
+void bench_region(){
+  printf("==== region: %d requests of %d objects ====\n",REQUESTS,REQUEST_OBJS);
+  printf("%12s %14s %10s %12s\n","method","heap_bytes","msecs","ns/object");
+  time_region(0);
+  time_region(1);
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// slab: churn of fixed-size objects
+
+#define SLAB_OBJ_SIZE 48        // size of each object
+#define SLAB_LIVE     4096      // objects kept live
+#define SLAB_OPS      (1 << 22) // free/alloc pairs timed
+
+// Keeps SLAB_LIVE objects of SLAB_OBJ_SIZE live and repeatedly frees
+// a random one and allocates a replacement. If use_slab is nonzero the
+// objects come from a slab cache; otherwise from el_malloc(). Reports
+// the heap size needed and the time per pair.
+void time_slab(int use_slab){
+  el_init();
+  void **objs = malloc(SLAB_LIVE * sizeof(void *));
+  el_slab_cache_t *cache = use_slab ? el_slab_create(SLAB_OBJ_SIZE, EL_ALIGNMENT) : NULL;
+  for(int i=0; i<SLAB_LIVE; i++){
+    objs[i] = use_slab ? el_slab_alloc(cache) : el_malloc(SLAB_OBJ_SIZE);
+  }
+  srand(216);
+  double beg = now_nsecs();
+  for(int i=0; i<SLAB_OPS; i++){
+    int s = rand() % SLAB_LIVE;
+    if(use_slab){
+      el_slab_free(cache, objs[s]);
+      objs[s] = el_slab_alloc(cache);
+    }
+    else{
+      el_free(objs[s]);
+      objs[s] = el_malloc(SLAB_OBJ_SIZE);
+    }
+  }
+  double end = now_nsecs();
+  printf("%12s %14lu %12.1f\n", use_slab ? "slab" : "el_malloc",
+         el_ctl->heap_bytes, (end-beg)/SLAB_OPS);
+  free(objs);
+  el_cleanup();
+}
+
+void bench_slab(){
+  printf("==== slab: %d live objects of %d bytes ====\n",SLAB_LIVE,SLAB_OBJ_SIZE);
+  printf("%12s %14s %12s\n","method","heap_bytes","ns/pair");
+  time_slab(0);
+  time_slab(1);
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// large: big short-lived buffers among long-lived small blocks
+
+#define LARGE_BYTES  (4 << 20)  // size of each large buffer
+#define LARGE_ROUNDS 64         // large buffers allocated and freed
+#define LARGE_SMALLS 256        // small blocks left live during each round
+
+// Each round allocates a large buffer, touches it, allocates some
+// small blocks which are never freed, and frees the buffer. With the
+// given mmap threshold of 0 buffers come from the heap and the small
+// blocks land in the space they free, pinning it in the heap.
+// Reports the heap size left at the end, the bytes trimmed from it
+// along the way, and the time.
+void time_large(size_t threshold){
+  el_init();
+  el_ctl->mmap_threshold = threshold;
+  double beg = now_nsecs();
+  for(int r=0; r<LARGE_ROUNDS; r++){
+    char *buf = el_malloc(LARGE_BYTES);
+    memset(buf, r, LARGE_BYTES);
+    for(int i=0; i<LARGE_SMALLS; i++){
+      el_malloc(64);
+    }
+    el_free(buf);
+  }
+  double end = now_nsecs();
+  printf("%10lu %14lu %14lu %14lu %10.1f\n", threshold, el_ctl->heap_bytes,
+         el_ctl->released_bytes, el_ctl->mapped_bytes, (end-beg)/1e6);
+  el_cleanup();
+}
+
+void bench_large(){
+  printf("==== large: %d buffers of %d bytes ====\n",LARGE_ROUNDS,LARGE_BYTES);
+  printf("%10s %14s %14s %14s %10s\n","threshold","heap_bytes","released","mapped_bytes","msecs");
+  time_large(0);
+  time_large(EL_MMAP_THRESHOLD);
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// engines: fragmentation and throughput of the allocation engines
+
+#define TRACE_OPS    (1 << 20)  // operations in each trace
+#define TRACE_SLOTS  4096       // live blocks a trace may hold
+
+// Replays a trace of TRACE_OPS operations on a fresh heap with the
+// given engine flags. Each operation picks a random slot and frees its
+// block if it has one or otherwise allocates a block whose size is
+// drawn from sizes[]. The same seed gives the same trace for every
+// engine. Reports the peak of the bytes requested by live blocks, the
+// peak heap size, the ratio of the two as utilization, the average
+// number of blocks examined per search of the available list for the
+// list engines, and the time.
+void time_trace(char *trace, int flags, size_t *sizes, int nsizes){
+  el_init_flags(flags);
+  void **slots = calloc(TRACE_SLOTS, sizeof(void *));
+  size_t *lens = calloc(TRACE_SLOTS, sizeof(size_t));
+  size_t live = 0, peak_live = 0, peak_heap = 0;
+  srand(216);
+  double beg = now_nsecs();
+  for(int i=0; i<TRACE_OPS; i++){
+    int s = rand() % TRACE_SLOTS;
+    if(slots[s] != NULL){
+      el_free(slots[s]);
+      slots[s] = NULL;
+      live -= lens[s];
+    }
+    else{
+      lens[s] = sizes[rand() % nsizes];
+      slots[s] = el_malloc(lens[s]);
+      live += lens[s];
+      if(live > peak_live) peak_live = live;
+      if(el_ctl->heap_bytes > peak_heap) peak_heap = el_ctl->heap_bytes;
+    }
+  }
+  double end = now_nsecs();
+  char steps[32] = "-";
+  if(el_ctl->search_count > 0){
+    snprintf(steps, sizeof(steps), "%.1f", (double) el_ctl->search_steps / el_ctl->search_count);
+  }
+  printf("%10s %12s %12lu %12lu %8.1f %10s %10.1f\n", trace,
+         flags & EL_BUDDY ? "buddy" : flags & EL_BEST_FIT ? "best-fit" :
+         flags & EL_ADDRESS_ORDER ? "address" : flags & EL_SEGREGATED ? "segregated" :
+         flags & EL_NEXT_FIT ? "next-fit" : flags & EL_DEFERRED ? "deferred" : "first-fit",
+         peak_live, peak_heap, 100.0*peak_live/peak_heap, steps, (end-beg)/1e6);
+  free(slots);
+  free(lens);
+  el_cleanup();
+}
+
+void bench_engines(){
+  size_t uniform[1024], pow2[7], mixed[4] = {24, 40, 120, 1000};
+  for(int i=0; i<1024; i++){
+    uniform[i] = 16 + i;
+  }
+  for(int i=0; i<7; i++){
+    pow2[i] = 16 << i;
+  }
+  printf("==== engines: %d operations on %d slots ====\n",TRACE_OPS,TRACE_SLOTS);
+  printf("%10s %12s %12s %12s %8s %10s %10s\n","trace","engine","peak_live","peak_heap","util%","steps","msecs");
+  int engines[] = {0, EL_NEXT_FIT, EL_DEFERRED, EL_ADDRESS_ORDER, EL_SEGREGATED, EL_BEST_FIT, EL_BUDDY};
+  int nengines = sizeof(engines)/sizeof(engines[0]);
+  for(int e=0; e<nengines; e++){
+    time_trace("uniform", engines[e], uniform, 1024);
+  }
+  for(int e=0; e<nengines; e++){
+    time_trace("pow2", engines[e], pow2, 7);
+  }
+  for(int e=0; e<nengines; e++){
+    time_trace("mixed", engines[e], mixed, 4);
+  }
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// coalesce: cost of merging long runs of adjacent free blocks
+
+#define RUN_SIZE  64            // size of each block in a run
+
+// Fills the heap with a run of nblocks adjacent blocks of RUN_SIZE
+// and frees them in random order with EL_DEFERRED and no threshold so
+// that none is merged, then times one el_consolidate() merging the
+// whole run. Reports the time per block and the length of the
+// available list afterwards, which is 1 when the run and the free
+// space above it become a single block.
+void time_coalesce(int nblocks){
+  el_init_flags(EL_DEFERRED);
+  el_ctl->quick_threshold = SIZE_MAX;
+  reserve_heap((size_t) nblocks * (RUN_SIZE + EL_BLOCK_OVERHEAD));
+  void **blocks = malloc(nblocks * sizeof(void *));
+  for(int i=0; i<nblocks; i++){
+    blocks[i] = el_malloc(RUN_SIZE);
+  }
+  srand(216);
+  for(int i=nblocks-1; i>0; i--){               // shuffle
+    int j = rand() % (i+1);
+    void *tmp = blocks[i];
+    blocks[i] = blocks[j];
+    blocks[j] = tmp;
+  }
+  for(int i=0; i<nblocks; i++){
+    el_free(blocks[i]);
+  }
+
+  double beg = now_nsecs();
+  el_consolidate();
+  double end = now_nsecs();
+  printf("%10d %10.1f %12.1f %12lu\n", nblocks, (end-beg)/1e6,
+         (end-beg)/nblocks, el_ctl->avail->length);
+  free(blocks);
+  el_cleanup();
+}
+
+void bench_coalesce(){
+  printf("==== coalesce: merging a run of deferred %d byte blocks ====\n",RUN_SIZE);
+  printf("%10s %10s %12s %12s\n","blocks","msecs","ns/block","avail_len");
+  for(int nblocks=1000; nblocks<=1024000; nblocks*=4){
+    time_coalesce(nblocks);
+  }
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// churn: throughput of malloc/free pairs
+
+#define CHURN_OPS    (1 << 22)  // malloc/free pairs done
+#define CHURN_SLOTS  1024       // live blocks kept
+
+// Repeatedly frees a random one of CHURN_SLOTS live blocks and
+// allocates a replacement of random size under the given engine
+// flags, reporting millions of malloc/free pairs per second. Build
+// el_malloc_benchmark_nolist to compare against EL_NO_USED_LIST.
+void time_churn(int flags){
+  el_init_flags(flags);
+  void *slots[CHURN_SLOTS] = {};
+  srand(216);
+  double beg = now_nsecs();
+  for(int i=0; i<CHURN_OPS; i++){
+    int s = rand() % CHURN_SLOTS;
+    el_free(slots[s]);
+    slots[s] = el_malloc(16 + rand() % 496);
+  }
+  double end = now_nsecs();
+  printf("%12s %10.1f %12.2f\n",
+         flags & EL_SEGREGATED ? "segregated" : "first-fit",
+         (end-beg)/1e6, CHURN_OPS/((end-beg)/1e3));
+  el_cleanup();
+}
+
+void bench_churn(){
+#ifdef EL_NO_USED_LIST
+  char *mode = "without used list";
+#else
+  char *mode = "with used list";
+#endif
+  printf("==== churn: %d malloc/free pairs %s ====\n",CHURN_OPS,mode);
+  printf("%12s %10s %12s\n","engine","msecs","Mops/sec");
+  time_churn(0);
+  time_churn(EL_SEGREGATED);
+  printf("\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// glibc: common allocation patterns under el_malloc() and the system
+// malloc() of the same binary
+
+#define SUITE_OPS    (1 << 21)  // replacements made by the churn patterns
+#define SUITE_LIVE   4096       // blocks kept live by the churn patterns
+#define SUITE_ROUNDS 256        // batches allocated and freed by the lifo/fifo patterns
+#define SUITE_BUFS   64         // buffers grown together by the realloc pattern
+#define SUITE_STEP   64         // bytes each buffer grows by per el_realloc()
+#define SUITE_GROWN  (64*1024)  // size at which a buffer is freed and started again
+#define LARSON_THREADS 8        // simulated threads of the larson pattern
+#define LARSON_BURST 256        // replacements each thread makes before the next runs
+
+int json = 0;                   // nonzero to print JSON rather than a table
+
+// An allocator under test; the system allocator has flags of -1
+typedef struct {
+  char *name;
+  int flags;
+  void *(*malloc)(size_t);
+  void (*free)(void *);
+  void *(*realloc)(void *, size_t);
+} allocator_t;
+
+allocator_t allocators[] = {
+  {"glibc",      -1,            malloc,    free,    realloc},
+  {"first-fit",  0,             el_malloc, el_free, el_realloc},
+  {"segregated", EL_SEGREGATED, el_malloc, el_free, el_realloc},
+};
+
+unsigned int suite_seed;        // state of suite_rand()
+
+// Return a pseudo-random number from a xorshift generator which is
+// cheap enough not to hide the cost of the allocator
+unsigned int suite_rand(){
+  suite_seed ^= suite_seed << 13;
+  suite_seed ^= suite_seed >> 17;
+  suite_seed ^= suite_seed << 5;
+  return suite_seed;
+}
+
+// Each pattern makes allocator calls on al and returns how many.
+// Every block allocated is touched so that it counts towards RSS.
+
+// Frees a random live block and allocates one of the same size
+long pattern_fixed(allocator_t *al){
+  void **slots = calloc(SUITE_LIVE, sizeof(void *));
+  for(int i=0; i<SUITE_OPS; i++){
+    int s = suite_rand() % SUITE_LIVE;
+    al->free(slots[s]);
+    slots[s] = al->malloc(64);
+    *(char *) slots[s] = i;
+  }
+  for(int s=0; s<SUITE_LIVE; s++){
+    al->free(slots[s]);
+  }
+  free(slots);
+  return 2L*SUITE_OPS + SUITE_LIVE;
+}
+
+// Frees a random live block and allocates one of a random size up to
+// 4096 bytes
+long pattern_random(allocator_t *al){
+  void **slots = calloc(SUITE_LIVE, sizeof(void *));
+  for(int i=0; i<SUITE_OPS; i++){
+    int s = suite_rand() % SUITE_LIVE;
+    al->free(slots[s]);
+    slots[s] = al->malloc(16 + suite_rand() % 4081);
+    *(char *) slots[s] = i;
+  }
+  for(int s=0; s<SUITE_LIVE; s++){
+    al->free(slots[s]);
+  }
+  free(slots);
+  return 2L*SUITE_OPS + SUITE_LIVE;
+}
+
+// Allocates batches of SUITE_LIVE blocks of random sizes up to 512
+// bytes and frees each batch newest first if lifo is nonzero or
+// oldest first otherwise
+long pattern_order(allocator_t *al, int lifo){
+  void **blocks = malloc(SUITE_LIVE * sizeof(void *));
+  for(int r=0; r<SUITE_ROUNDS; r++){
+    for(int i=0; i<SUITE_LIVE; i++){
+      blocks[i] = al->malloc(16 + suite_rand() % 497);
+      *(char *) blocks[i] = i;
+    }
+    for(int i=0; i<SUITE_LIVE; i++){
+      al->free(blocks[lifo ? SUITE_LIVE-1-i : i]);
+    }
+  }
+  free(blocks);
+  return 2L*SUITE_ROUNDS*SUITE_LIVE;
+}
+
+long pattern_lifo(allocator_t *al){
+  return pattern_order(al, 1);
+}
+
+long pattern_fifo(allocator_t *al){
+  return pattern_order(al, 0);
+}
+
+// Grows SUITE_BUFS buffers round-robin by SUITE_STEP bytes at a time
+// with realloc() among small allocations that keep their neighbors
+// busy. A buffer reaching SUITE_GROWN is freed and starts over.
+long pattern_realloc(allocator_t *al){
+  void *bufs[SUITE_BUFS] = {};
+  size_t lens[SUITE_BUFS] = {};
+  void **smalls = calloc(SUITE_LIVE, sizeof(void *));
+  long calls = 0;
+  for(int i=0; i<SUITE_OPS; i++){
+    int b = i % SUITE_BUFS;
+    if(lens[b] >= SUITE_GROWN){
+      al->free(bufs[b]);
+      bufs[b] = NULL;
+      lens[b] = 0;
+    }
+    lens[b] += SUITE_STEP;
+    bufs[b] = al->realloc(bufs[b], lens[b]);
+    ((char *) bufs[b])[lens[b]-1] = i;
+    calls++;
+    if(i % 4 == 0){
+      int s = suite_rand() % SUITE_LIVE;
+      al->free(smalls[s]);
+      smalls[s] = al->malloc(32);
+      *(char *) smalls[s] = i;
+      calls += 2;
+    }
+  }
+  for(int b=0; b<SUITE_BUFS; b++){
+    al->free(bufs[b]);
+  }
+  for(int s=0; s<SUITE_LIVE; s++){
+    al->free(smalls[s]);
+  }
+  free(smalls);
+  return calls + SUITE_BUFS + SUITE_LIVE;
+}
+
+// Larson-style server pattern run in one thread: LARSON_THREADS
+// simulated threads take turns making LARSON_BURST replacements of
+// random sizes up to 1024 bytes in their own slots. After each full
+// turn the slot arrays pass on to the next thread so that blocks are
+// freed by a different thread than allocated them, in an order unlike
+// the one they were allocated in. The threaded version of this is in
+// el_mt_benchmark.
+long pattern_larson(allocator_t *al){
+  void **slots[LARSON_THREADS];
+  for(int t=0; t<LARSON_THREADS; t++){
+    slots[t] = calloc(SUITE_LIVE / LARSON_THREADS, sizeof(void *));
+  }
+  for(int i=0; i<SUITE_OPS; i++){
+    int t = (i / LARSON_BURST) % LARSON_THREADS;
+    if(i % (LARSON_BURST*LARSON_THREADS) == 0){
+      void **first = slots[0];            // pass the arrays on
+      for(int u=0; u<LARSON_THREADS-1; u++){
+        slots[u] = slots[u+1];
+      }
+      slots[LARSON_THREADS-1] = first;
+    }
+    int s = suite_rand() % (SUITE_LIVE / LARSON_THREADS);
+    al->free(slots[t][s]);
+    slots[t][s] = al->malloc(16 + suite_rand() % 1009);
+    *(char *) slots[t][s] = i;
+  }
+  for(int t=0; t<LARSON_THREADS; t++){
+    for(int s=0; s<SUITE_LIVE / LARSON_THREADS; s++){
+      al->free(slots[t][s]);
+    }
+    free(slots[t]);
+  }
+  return 2L*SUITE_OPS + SUITE_LIVE;
+}
+
+// Runs pattern under al in a child process so that its peak RSS is
+// its own and the allocator starts fresh, and prints a table row or
+// JSON object of nanoseconds per allocator call and peak RSS. The
+// first JSON object of a run is printed without a leading comma.
+void time_suite(char *name, long (*pattern)(allocator_t *), allocator_t *al, int first){
+  fflush(stdout);
+  pid_t child = fork();
+  if(child != 0){
+    waitpid(child, NULL, 0);
+    return;
+  }
+  if(al->flags >= 0){
+    el_init_flags(al->flags);
+  }
+  suite_seed = 216;
+  double beg = now_nsecs();
+  long calls = pattern(al);
+  double end = now_nsecs();
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  if(json){
+    printf("%s  {\"pattern\": \"%s\", \"allocator\": \"%s\", \"calls\": %ld, "
+           "\"ns_per_call\": %.2f, \"peak_rss_kb\": %ld}",
+           first ? "" : ",\n", name, al->name, calls, (end-beg)/calls, usage.ru_maxrss);
+  }
+  else{
+    printf("%10s %12s %12ld %10.1f %12ld\n",
+           name, al->name, calls, (end-beg)/calls, usage.ru_maxrss);
+  }
+  fflush(stdout);
+  _exit(0);
+}
+
+void bench_glibc(){
+  char *names[] = {"fixed", "random", "lifo", "fifo", "realloc", "larson"};
+  long (*patterns[])(allocator_t *) = {pattern_fixed, pattern_random, pattern_lifo,
+                                       pattern_fifo, pattern_realloc, pattern_larson};
+  int npatterns = sizeof(patterns)/sizeof(patterns[0]);
+  int nallocators = sizeof(allocators)/sizeof(allocators[0]);
+  if(json){
+    printf("[\n");
+  }
+  else{
+    printf("==== glibc: allocation patterns under el_malloc() and glibc malloc() ====\n");
+    printf("%10s %12s %12s %10s %12s\n","pattern","allocator","calls","ns/call","peak_rss_kb");
+  }
+  for(int p=0; p<npatterns; p++){
+    for(int a=0; a<nallocators; a++){
+      time_suite(names[p], patterns[p], &allocators[a], p == 0 && a == 0);
+    }
+  }
+  printf(json ? "\n]\n" : "\n");
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]){
+  char *all[] = {"freelist", "growth", "realloc", "calloc", "region", "slab", "large", "engines", "coalesce", "churn", "glibc"};
+  char *suite[] = {"glibc"};
+  char **names = argv+1;
+  int count = argc-1;
+  if(count > 0 && strcmp(names[0], "-j") == 0){
+    json = 1;
+    names++;
+    count--;
+  }
+  if(count == 0){
+    names = json ? suite : all;
+    count = json ? 1 : sizeof(all)/sizeof(all[0]);
+  }
+
+  for(int i=0; i<count; i++){
+    char *bench_name = names[i];
+    if(0){}
+    else if( strcmp( bench_name, "freelist" )==0 ){
+      bench_freelist();
+    }
+    else if( strcmp( bench_name, "growth" )==0 ){
+      bench_growth();
+    }
+    else if( strcmp( bench_name, "realloc" )==0 ){
+      bench_realloc();
+    }
+    else if( strcmp( bench_name, "calloc" )==0 ){
+      bench_calloc();
+    }
+    else if( strcmp( bench_name, "region" )==0 ){
+      bench_region();
+    }
+    else if( strcmp( bench_name, "slab" )==0 ){
+      bench_slab();
+    }
+    else if( strcmp( bench_name, "large" )==0 ){
+      bench_large();
+    }
+    else if( strcmp( bench_name, "engines" )==0 ){
+      bench_engines();
+    }
+    else if( strcmp( bench_name, "coalesce" )==0 ){
+      bench_coalesce();
+    }
+    else if( strcmp( bench_name, "churn" )==0 ){
+      bench_churn();
+    }
+    else if( strcmp( bench_name, "glibc" )==0 ){
+      bench_glibc();
+    }
+    else{
+      printf("No benchmark named '%s' found\n",bench_name);
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,349 @@
+// el_mt_benchmark.c: throughput of the thread-safe build of
+// el_malloc() as the number of threads grows. Run with an optional
+// maximum number of threads, then optionally the workloads to run;
+// the thread count doubles from 1 up to that maximum for each. Every
+// workload reports throughput, the share of frees that reached
+// another arena's remote free stack, and latency percentiles of a
+// sample of calls, followed by a latency histogram of each thread at
+// the largest thread count.
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include "el_malloc.h"
+
+#define THREAD_OPS   (1 << 20)  // malloc/free pairs done by each thread
+#define THREAD_SLOTS 256        // live blocks kept by each thread
+#define MAX_THREADS  64
+#define RING_SIZE    1024       // blocks in flight between a producer and its consumer
+#define BATCH_SIZE   1024       // blocks a threadtest thread allocates before freeing them all
+#define LARSON_ROUND (1 << 14)  // replacements a larson thread makes before passing its blocks on
+#define LAT_SAMPLE   16         // one call in this many is timed
+#define LAT_BUCKETS  12         // latency histogram buckets; bucket i holds calls under 32 << i ns
+
+// Return the current time in nanoseconds from a monotonic clock
+double now_nsecs(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// State of one thread of a workload
+typedef struct {
+  int id;                       // thread number from 0
+  int nthreads;                 // threads in the workload
+  unsigned int seed;            // rand_r() state
+  long calls;                   // el_malloc() and el_free() calls made
+  long frees;                   // el_free() calls made
+  long corrupt;                 // blocks found overwritten by another thread
+  long hist[LAT_BUCKETS];       // sampled calls by latency
+  void *shared;                 // state shared by the threads of the workload
+} thread_t;
+
+// Add a call of the given nanoseconds to the histogram of t
+void record_latency(thread_t *t, double nsecs){
+  int b = 0;
+  while(b < LAT_BUCKETS-1 && nsecs >= (32 << b)){
+    b++;
+  }
+  t->hist[b]++;
+}
+
+// el_malloc() for thread t, timing one call in LAT_SAMPLE
+void *t_malloc(thread_t *t, size_t nbytes){
+  if(t->calls++ % LAT_SAMPLE != 0){
+    return el_malloc(nbytes);
+  }
+  double beg = now_nsecs();
+  void *ptr = el_malloc(nbytes);
+  record_latency(t, now_nsecs() - beg);
+  return ptr;
+}
+
+// el_free() for thread t, timing one call in LAT_SAMPLE
+void t_free(thread_t *t, void *ptr){
+  t->frees++;
+  if(t->calls++ % LAT_SAMPLE != 0){
+    el_free(ptr);
+    return;
+  }
+  double beg = now_nsecs();
+  el_free(ptr);
+  record_latency(t, now_nsecs() - beg);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Workloads; each runs in every thread with its thread_t as argument
+
+// churn: each thread repeatedly frees a random one of its live blocks
+// and allocates a replacement of random size, marking the first byte
+// of every block so that blocks handed to two threads at once are
+// detected.
+void *churn(void *arg){
+  thread_t *t = arg;
+  char mark = 'A' + t->id % 26;
+  char *slots[THREAD_SLOTS] = {};
+  for(int i=0; i<THREAD_OPS; i++){
+    int s = rand_r(&t->seed) % THREAD_SLOTS;
+    if(slots[s] != NULL){
+      t->corrupt += slots[s][0] != mark;
+      t_free(t, slots[s]);
+    }
+    slots[s] = t_malloc(t, 16 + rand_r(&t->seed) % 496);
+    slots[s][0] = mark;
+  }
+  for(int s=0; s<THREAD_SLOTS; s++){
+    t_free(t, slots[s]);
+  }
+  return NULL;
+}
+
+// threadtest: each thread allocates a batch of BATCH_SIZE blocks of
+// 64 bytes and then frees them all, over and over, as in the
+// threadtest benchmark of Hoard.
+void *threadtest(void *arg){
+  thread_t *t = arg;
+  char mark = 'A' + t->id % 26;
+  char *batch[BATCH_SIZE];
+  for(int r=0; r<THREAD_OPS / BATCH_SIZE; r++){
+    for(int i=0; i<BATCH_SIZE; i++){
+      batch[i] = t_malloc(t, 64);
+      batch[i][0] = mark;
+    }
+    for(int i=0; i<BATCH_SIZE; i++){
+      t->corrupt += batch[i][0] != mark;
+      t_free(t, batch[i]);
+    }
+  }
+  return NULL;
+}
+
+// Blocks and barrier shared by the threads of the larson workload
+typedef struct {
+  int **slots[MAX_THREADS];     // THREAD_SLOTS blocks held by each thread
+  pthread_barrier_t barrier;    // passed by all threads between rounds
+} larson_t;
+
+// larson: each thread replaces random blocks of its slots with blocks
+// of random size for LARSON_ROUND replacements, then every thread
+// takes over the slots of the next one, as the threads of the larson
+// server benchmark hand their blocks to the threads that succeed
+// them. Blocks are thereafter freed by a thread other than the one
+// that allocated them. Each block holds the index of its slot.
+void *larson(void *arg){
+  thread_t *t = arg;
+  larson_t *l = t->shared;
+  int **slots = l->slots[t->id];
+  for(int i=0; i<THREAD_OPS; i++){
+    if(i > 0 && i % LARSON_ROUND == 0){
+      pthread_barrier_wait(&l->barrier);
+      slots = l->slots[(t->id + i / LARSON_ROUND) % t->nthreads];
+    }
+    int s = rand_r(&t->seed) % THREAD_SLOTS;
+    if(slots[s] != NULL){
+      t->corrupt += slots[s][0] != s;
+      t_free(t, slots[s]);
+    }
+    slots[s] = t_malloc(t, 16 + rand_r(&t->seed) % 496);
+    slots[s][0] = s;
+  }
+  return NULL;
+}
+
+// A ring of blocks passed from a producer thread which allocates them
+// to a consumer thread which frees them
+typedef struct {
+  void *slots[RING_SIZE];
+  size_t head;                  // next slot the producer fills
+  size_t tail;                  // next slot the consumer empties
+} ring_t;
+
+// pipeline: even threads produce blocks marked with their sequence
+// number and odd threads consume them, each pair sharing a ring. Every
+// block is freed by a thread other than the one that allocated it.
+void *pipeline(void *arg){
+  thread_t *t = arg;
+  ring_t *ring = (ring_t *) t->shared + t->id / 2;
+  if(t->id % 2 == 0){
+    for(size_t i=0; i<THREAD_OPS; i++){
+      char *ptr = t_malloc(t, 16 + rand_r(&t->seed) % 496);
+      ptr[0] = i;
+      while(i - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE){
+        sched_yield();
+      }
+      ring->slots[i % RING_SIZE] = ptr;
+      __atomic_store_n(&ring->head, i+1, __ATOMIC_RELEASE);
+    }
+  }
+  else{
+    for(size_t i=0; i<THREAD_OPS; i++){
+      while(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == i){
+        sched_yield();
+      }
+      char *ptr = ring->slots[i % RING_SIZE];
+      t->corrupt += ptr[0] != (char) i;
+      t_free(t, ptr);
+      __atomic_store_n(&ring->tail, i+1, __ATOMIC_RELEASE);
+    }
+  }
+  return NULL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Harness
+
+// Return the upper bound in nanoseconds of the bucket holding the
+// given fraction of the calls of hist, or -1 for the last bucket which
+// has none
+long percentile(long hist[], double frac){
+  long total = 0, seen = 0;
+  for(int b=0; b<LAT_BUCKETS; b++){
+    total += hist[b];
+  }
+  for(int b=0; b<LAT_BUCKETS-1; b++){
+    seen += hist[b];
+    if(seen >= frac*total){
+      return 32L << b;
+    }
+  }
+  return -1;
+}
+
+// Print the histogram of each thread as percentages of its sampled
+// calls
+void print_histograms(thread_t threads[], int nthreads){
+  printf("latency of sampled calls at %d threads, %% of calls under each bound in ns\n", nthreads);
+  printf("%8s","thread");
+  for(int b=0; b<LAT_BUCKETS-1; b++){
+    printf(" %6ld", 32L << b);
+  }
+  printf(" %6s\n", "more");
+  for(int i=0; i<nthreads; i++){
+    long total = 0;
+    for(int b=0; b<LAT_BUCKETS; b++){
+      total += threads[i].hist[b];
+    }
+    printf("%8d", i);
+    for(int b=0; b<LAT_BUCKETS; b++){
+      printf(" %6.1f", total > 0 ? 100.0*threads[i].hist[b]/total : 0.0);
+    }
+    printf("\n");
+  }
+}
+
+// Run a workload at 1, 2, 4... up to max_threads threads on a fresh
+// set of arenas each time, starting at 2 threads for the pipeline
+// whose threads work in pairs. Prints a row per thread count of calls
+// per second, speedup over the first row, the thread cache hit rate,
+// the percentage of frees drained from remote free stacks, sampled
+// latency percentiles, and corrupted blocks, then the histograms of
+// the largest run.
+void run_workload(char *name, void *(*work)(void *), int max_threads){
+  printf("==== %s: %d malloc/free pairs per thread over %d arenas ====\n",
+         name, THREAD_OPS, EL_ARENA_COUNT);
+  printf("%8s %10s %12s %10s %10s %10s %8s %8s %8s\n","threads","msecs","Mcalls/sec",
+         "speedup","tcache%","remote%","p50 ns","p99 ns","corrupt");
+  static thread_t threads[MAX_THREADS];
+  int min_threads = work == pipeline ? 2 : 1;
+  if(max_threads < min_threads){
+    printf("needs at least %d threads\n\n", min_threads);
+    return;
+  }
+  int last = min_threads;
+  double base = 0;
+  for(int nthreads=min_threads; nthreads<=max_threads; nthreads*=2){
+    pthread_t tids[MAX_THREADS];
+    ring_t *rings = calloc(nthreads, sizeof(ring_t));
+    larson_t *larson_state = calloc(1, sizeof(larson_t));
+    for(int i=0; i<nthreads; i++){
+      larson_state->slots[i] = calloc(THREAD_SLOTS, sizeof(int *));
+    }
+    pthread_barrier_init(&larson_state->barrier, NULL, nthreads);
+
+    el_init();
+    double beg = now_nsecs();
+    for(int i=0; i<nthreads; i++){
+      threads[i] = (thread_t) {.id = i, .nthreads = nthreads, .seed = i+1,
+                               .shared = work == pipeline ? (void *) rings : larson_state};
+      pthread_create(&tids[i], NULL, work, &threads[i]);
+    }
+    for(int i=0; i<nthreads; i++){
+      pthread_join(tids[i], NULL);
+    }
+    double end = now_nsecs();
+
+    long calls = 0, frees = 0, corrupt = 0, hist[LAT_BUCKETS] = {};
+    for(int i=0; i<nthreads; i++){
+      calls += threads[i].calls;
+      frees += threads[i].frees;
+      corrupt += threads[i].corrupt;
+      for(int b=0; b<LAT_BUCKETS; b++){
+        hist[b] += threads[i].hist[b];
+      }
+    }
+    size_t hits = 0, misses = 0, remote = 0;
+    for(int i=0; i<EL_ARENA_COUNT; i++){
+      hits += el_arena(i)->tcache_hits;
+      misses += el_arena(i)->tcache_misses;
+      remote += el_arena(i)->remote_frees;
+    }
+    el_cleanup();
+    if(work == larson){                     // blocks left in the slots went with the arenas
+      for(int i=0; i<nthreads; i++){
+        free(larson_state->slots[i]);
+      }
+    }
+    pthread_barrier_destroy(&larson_state->barrier);
+    free(larson_state);
+    free(rings);
+
+    double mcalls = calls / ((end-beg)/1e3);
+    if(nthreads == min_threads){
+      base = mcalls;
+    }
+    printf("%8d %10.1f %12.2f %10.2f %10.1f %10.1f %8ld %8ld %8ld\n",
+           nthreads, (end-beg)/1e6, mcalls, mcalls/base,
+           hits+misses > 0 ? 100.0*hits/(hits+misses) : 0.0,
+           frees > 0 ? 100.0*remote/frees : 0.0,
+           percentile(hist, 0.50), percentile(hist, 0.99), corrupt);
+    last = nthreads;
+  }
+  print_histograms(threads, last);
+  printf("\n");
+}
+
+int main(int argc, char *argv[]){
+  int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+  if(max_threads < 1 || max_threads > MAX_THREADS){
+    printf("thread count must be from 1 to %d\n",MAX_THREADS);
+    return 1;
+  }
+  char *all[] = {"churn", "threadtest", "larson", "pipeline"};
+  char **names = argc > 2 ? argv+2 : all;
+  int count = argc > 2 ? argc-2 : (int) (sizeof(all)/sizeof(all[0]));
+
+  for(int i=0; i<count; i++){
+    char *name = names[i];
+    if(0){}
+    else if( strcmp( name, "churn" )==0 ){
+      run_workload(name, churn, max_threads);
+    }
+    else if( strcmp( name, "threadtest" )==0 ){
+      run_workload(name, threadtest, max_threads);
+    }
+    else if( strcmp( name, "larson" )==0 ){
+      run_workload(name, larson, max_threads);
+    }
+    else if( strcmp( name, "pipeline" )==0 ){
+      run_workload(name, pipeline, max_threads);
+    }
+    else{
+      printf("No workload named '%s' found\n",name);
+      return 1;
+    }
+  }
+  return 0;
+}
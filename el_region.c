@@ -0,0 +1,111 @@
+// el_region.c: regions of short-lived objects allocated by bumping a
+// pointer through large chunks taken from the el_malloc() heap and
+// released all at once.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "el_malloc.h"
+
+// Header at the start of every chunk of a region; objects follow it
+typedef struct el_chunk {
+  struct el_chunk *next;        // chunk allocated before this one
+  size_t bytes;                 // usable bytes in the chunk after this header
+} el_chunk_t;
+
+// Round a size up to a multiple of EL_ALIGNMENT
+#define EL_ROUND_ALIGN(n) (((n) + EL_ALIGNMENT - 1) & ~((size_t) EL_ALIGNMENT - 1))
+
+#define EL_CHUNK_HEAD   EL_ROUND_ALIGN(sizeof(el_chunk_t))
+#define EL_REGION_HEAD  EL_ROUND_ALIGN(sizeof(el_region_t))
+#define EL_REGION_LARGE (EL_REGION_CHUNK / 4)
+
+// Allocate a chunk with room for bytes after its header with
+// el_malloc() and link it into the region's chunk list at link.
+// Returns a pointer to the space after the header or NULL if
+// el_malloc() fails.
+static void *el_region_chunk(el_chunk_t **link, size_t bytes){
+  if(bytes > SIZE_MAX - EL_CHUNK_HEAD){
+    return NULL;
+  }
+  el_chunk_t *chunk = el_malloc(EL_CHUNK_HEAD + bytes);
+  if(chunk == NULL){
+    return NULL;
+  }
+  chunk->next = *link;
+  chunk->bytes = bytes;
+  *link = chunk;
+  return PTR_PLUS_BYTES(chunk, EL_CHUNK_HEAD);
+}
+
+// Return a new empty region or NULL if no space is available. The
+// region lives at the start of its first chunk of EL_REGION_CHUNK
+// bytes.
+el_region_t *el_region_begin(){
+  el_chunk_t *chunk = el_malloc(EL_REGION_CHUNK);
+  if(chunk == NULL){
+    return NULL;
+  }
+  chunk->next = NULL;
+  chunk->bytes = EL_REGION_CHUNK - EL_CHUNK_HEAD;
+  el_region_t *region = PTR_PLUS_BYTES(chunk, EL_CHUNK_HEAD);
+  region->chunks = chunk;
+  region->next = PTR_PLUS_BYTES(region, EL_REGION_HEAD);
+  region->end = PTR_PLUS_BYTES(chunk, EL_REGION_CHUNK);
+  region->bytes = 0;
+  return region;
+}
+
+// Return a pointer to nbytes of space in the region aligned to
+// EL_ALIGNMENT. The space has no header: it is carved off the current
+// chunk by advancing a pointer, and a new chunk is taken only when
+// the current one is full. Objects over EL_REGION_LARGE get a chunk
+// of their own so that the rest of the current chunk is not wasted.
+// Returns NULL if no space is available.
+void *el_region_alloc(el_region_t *region, size_t nbytes){
+  if(nbytes > SIZE_MAX - EL_ALIGNMENT){
+    return NULL;
+  }
+  nbytes = EL_ROUND_ALIGN(nbytes);
+  if(nbytes > EL_REGION_LARGE){                 // behind the current chunk which stays in use
+    void *ptr = el_region_chunk(&region->chunks->next, nbytes);
+    if(ptr != NULL){
+      region->bytes += nbytes;
+    }
+    return ptr;
+  }
+  if(nbytes > (size_t) PTR_MINUS_PTR(region->end, region->next)){
+    void *next = el_region_chunk(&region->chunks, EL_REGION_CHUNK - EL_CHUNK_HEAD);
+    if(next == NULL){
+      return NULL;
+    }
+    region->next = next;
+    region->end = PTR_PLUS_BYTES(next, EL_REGION_CHUNK - EL_CHUNK_HEAD);
+  }
+  void *ptr = region->next;
+  region->next = PTR_PLUS_BYTES(region->next, nbytes);
+  region->bytes += nbytes;
+  return ptr;
+}
+
+// Release everything allocated in the region at once leaving it empty
+// and ready for reuse. Every chunk but the first is freed.
+void el_region_reset(el_region_t *region){
+  el_chunk_t *chunk = region->chunks;
+  while(chunk->next != NULL){
+    el_chunk_t *next = chunk->next;
+    el_free(chunk);
+    chunk = next;
+  }
+  region->chunks = chunk;
+  region->next = PTR_PLUS_BYTES(region, EL_REGION_HEAD);
+  region->end = PTR_PLUS_BYTES(chunk, EL_CHUNK_HEAD + chunk->bytes);
+  region->bytes = 0;
+}
+
+// Release everything allocated in the region along with the region
+// itself
+void el_region_end(el_region_t *region){
+  el_region_reset(region);
+  el_free(region->chunks);
+}
@@ -0,0 +1,263 @@
+// el_replay.c: replay of an allocation trace recorded with
+// el_trace_begin() or by running a program with the environment
+// variable EL_TRACE set to the file to record. The trace alone is
+// enough to replay it. Each engine named on the command line, by name
+// or by el_init_flags() flags, replays the trace twice: once timed as
+// a whole for throughput and once timing each operation for latency
+// percentiles while following the size of the heap. With no engines
+// named the trace is replayed with the flags it was recorded with.
+//
+// usage: el_replay <trace> [engine...]
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "el_malloc.h"
+
+// Return the current time in nanoseconds from a monotonic clock
+double now_nsecs(){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+// Engines that may be named on the command line
+struct {
+  char *name;
+  int flags;
+} engines[] = {
+  {"first-fit",  0},
+  {"next-fit",   EL_NEXT_FIT},
+  {"deferred",   EL_DEFERRED},
+  {"address",    EL_ADDRESS_ORDER},
+  {"segregated", EL_SEGREGATED},
+  {"best-fit",   EL_BEST_FIT},
+  {"buddy",      EL_BUDDY},
+};
+#define NENGINES (int) (sizeof(engines)/sizeof(engines[0]))
+
+// Return the name of the engine with the given flags, or print the
+// flags themselves to buf and return it if no engine has exactly those
+char *engine_name(int flags, char *buf, int len){
+  for(int i=0; i<NENGINES; i++){
+    if(engines[i].flags == flags){
+      return engines[i].name;
+    }
+  }
+  snprintf(buf, len, "flags 0x%02x", flags);
+  return buf;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Trace loading
+
+el_trace_head_t head;           // start of the trace
+el_trace_rec_t *recs;           // operations of the trace
+size_t nrecs;                   // number of operations
+uint32_t max_id;                // largest pointer ID in the trace
+
+// Read the whole trace at path into recs. Prints an error and returns
+// 1 if it cannot be read or is not a trace.
+int load_trace(char *path){
+  FILE *file = fopen(path, "rb");
+  if(file == NULL){
+    printf("unable to open trace '%s'\n", path);
+    return 1;
+  }
+  fseek(file, 0, SEEK_END);
+  long bytes = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  if(bytes < (long) sizeof(head) ||
+     fread(&head, sizeof(head), 1, file) != 1 ||
+     memcmp(head.magic, EL_TRACE_MAGIC, sizeof(head.magic)) != 0)
+  {
+    printf("'%s' is not an allocation trace\n", path);
+    fclose(file);
+    return 1;
+  }
+  nrecs = (bytes - sizeof(head)) / sizeof(el_trace_rec_t);
+  recs = malloc(nrecs * sizeof(el_trace_rec_t) + 1);
+  if(recs == NULL || fread(recs, sizeof(el_trace_rec_t), nrecs, file) != nrecs){
+    printf("unable to read %lu operations from '%s'\n", nrecs, path);
+    fclose(file);
+    return 1;
+  }
+  fclose(file);
+
+  max_id = 0;
+  for(size_t i=0; i<nrecs; i++){
+    if(recs[i].op == 0 || strchr("mclrfp", recs[i].op) == NULL){
+      printf("operation %lu of '%s' is unknown\n", i, path);
+      return 1;
+    }
+    if(recs[i].id > max_id){
+      max_id = recs[i].id;
+    }
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Replay
+
+void **slots;                   // pointer of each ID during a replay
+size_t *sizes;                  // bytes requested for each live pointer
+size_t live;                    // total bytes requested for live pointers
+
+// Perform the operation rec on the pointers in slots, keeping sizes
+// and live up to date. Returns 1 if an allocation which succeeded
+// when traced fails now.
+int replay_op(el_trace_rec_t *rec){
+  uint32_t id = rec->id;
+  void *ptr;
+  switch(rec->op){
+    case EL_TRACE_MALLOC:
+      ptr = el_malloc(rec->size);
+      break;
+    case EL_TRACE_CALLOC:
+      ptr = el_calloc(1, rec->size);
+      break;
+    case EL_TRACE_ALIGNED:
+      ptr = el_aligned_alloc((size_t) 1 << rec->align_log2, rec->size);
+      break;
+    case EL_TRACE_REALLOC:
+      ptr = el_realloc(slots[id], rec->size);
+      if(ptr == NULL && rec->size > 0){
+        return 1;                         // old pointer is left as it was
+      }
+      live -= sizes[id];
+      slots[id] = NULL;
+      sizes[id] = 0;
+      break;
+    case EL_TRACE_FREE:
+      el_free(slots[id]);
+      live -= sizes[id];
+      slots[id] = NULL;
+      sizes[id] = 0;
+      return 0;
+    case EL_TRACE_APPEND:
+      return el_append_pages_to_heap(rec->size) != 0;
+    default:
+      return 1;
+  }
+  if(ptr == NULL){
+    return rec->size > 0 || rec->op != EL_TRACE_REALLOC;
+  }
+  slots[id] = ptr;
+  sizes[id] = rec->size;
+  live += rec->size;
+  return 0;
+}
+
+// Start a replay with the given engine flags and no live pointers
+void replay_begin(int flags){
+  el_init_flags(flags);
+  slots = calloc(max_id+1, sizeof(void *));
+  sizes = calloc(max_id+1, sizeof(size_t));
+  live = 0;
+}
+
+// Finish a replay, freeing its heap
+void replay_end(){
+  free(slots);
+  free(sizes);
+  el_cleanup();
+}
+
+// Order floats for qsort()
+int compare_floats(const void *a, const void *b){
+  float x = *(float *) a, y = *(float *) b;
+  return (x > y) - (x < y);
+}
+
+// Replay the trace with the given engine flags and print a row of
+// throughput, latency percentiles in nanoseconds, peak footprint of
+// the heap and mappings together, fragmentation, and failed
+// allocations. Fragmentation is the share of the peak footprint in
+// excess of the peak bytes requested by live pointers.
+void replay(int flags){
+  replay_begin(flags);
+  double beg = now_nsecs();
+  for(size_t i=0; i<nrecs; i++){
+    replay_op(&recs[i]);
+  }
+  double end = now_nsecs();
+  replay_end();
+
+  float *lat = malloc((nrecs+1) * sizeof(float));
+  size_t fails = 0, peak_live = 0, peak_bytes = 0;
+  replay_begin(flags);
+  for(size_t i=0; i<nrecs; i++){
+    double op_beg = now_nsecs();
+    fails += replay_op(&recs[i]);
+    lat[i] = now_nsecs() - op_beg;
+    size_t bytes = el_ctl->heap_bytes + el_ctl->mapped_bytes;
+    if(bytes > peak_bytes) peak_bytes = bytes;
+    if(live > peak_live) peak_live = live;
+  }
+  replay_end();
+  qsort(lat, nrecs, sizeof(float), compare_floats);
+
+  char buf[32];
+  double pcts[] = {0.50, 0.90, 0.99, 0.999};
+  printf("%12s %9.2f", engine_name(flags, buf, sizeof(buf)),
+         nrecs / ((end-beg)/1e3));
+  for(int p=0; p<4; p++){
+    printf(" %9.0f", nrecs > 0 ? lat[(size_t) (pcts[p]*(nrecs-1))] : 0.0);
+  }
+  printf(" %9.0f %9lu %6.1f %6lu\n",
+         nrecs > 0 ? lat[nrecs-1] : 0.0, peak_bytes / 1024,
+         peak_bytes > 0 ? 100.0 * (peak_bytes - peak_live) / peak_bytes : 0.0,
+         fails);
+  free(lat);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[]){
+  if(argc < 2){
+    printf("usage: %s <trace> [engine...]\n", argv[0]);
+    printf("engines:");
+    for(int i=0; i<NENGINES; i++){
+      printf(" %s", engines[i].name);
+    }
+    printf(" all, or el_init_flags() flags such as 0x21\n");
+    return 1;
+  }
+  unsetenv("EL_TRACE");                   // never trace the replay itself
+  if(load_trace(argv[1]) != 0){
+    return 1;
+  }
+
+  char buf[32];
+  printf("==== replay: %s  %lu ops over %.3f secs traced with %s ====\n",
+         argv[1], nrecs, nrecs > 0 ? recs[nrecs-1].nsecs / 1e9 : 0.0,
+         engine_name(head.flags, buf, sizeof(buf)));
+  printf("%12s %9s %9s %9s %9s %9s %9s %9s %6s %6s\n", "engine", "Mops/sec",
+         "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns", "peak KB", "frag%", "fails");
+  if(argc < 3){
+    replay(head.flags);
+  }
+  for(int a=2; a<argc; a++){
+    if(strcmp(argv[a], "all") == 0){
+      for(int i=0; i<NENGINES; i++){
+        replay(engines[i].flags);
+      }
+      continue;
+    }
+    int e = 0;
+    while(e < NENGINES && strcmp(argv[a], engines[e].name) != 0){
+      e++;
+    }
+    char *end;
+    int flags = e < NENGINES ? engines[e].flags : (int) strtol(argv[a], &end, 0);
+    if(e == NENGINES && (*end != '\0' || end == argv[a])){
+      printf("No engine named '%s' found\n", argv[a]);
+      return 1;
+    }
+    replay(flags);
+  }
+  free(recs);
+  return 0;
+}
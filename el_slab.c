@@ -0,0 +1,197 @@
+// el_slab.c: caches of fixed-size objects kept in page-sized slabs
+// taken from the el_malloc() heap, or mapped one page at a time on
+// EL_BUDDY heaps. Objects carry no header and are never split or
+// merged; each slab tracks its free slots in a list threaded through
+// the slots themselves.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "el_malloc.h"
+
+// Header at the start of every slab; slots follow it
+typedef struct el_slab {
+  struct el_slab *next;         // next slab in the cache's partial or full list
+  struct el_slab *prev;         // previous slab in the same list
+  void *free;                   // free slots, linked through their first word
+  size_t used;                  // slots handed out by el_slab_alloc()
+} el_slab_t;
+
+// Slabs lie offset bytes past an EL_SLAB_BYTES boundary so the slab
+// of an object is found by masking its address. Heap slabs have an
+// offset of 0 and are allocated EL_BLOCK_OVERHEAD short of a whole
+// slab so that the block holding the next slab starts right after it
+// without any leading slack. The EL_BUDDY engine cannot place a block
+// on such a boundary, so there each slab is the block of a page-sized
+// mapping from el_map_malloc() and sits EL_MAP_OFFSET bytes into it.
+#define EL_SLAB_USABLE (EL_SLAB_BYTES - EL_BLOCK_OVERHEAD)
+#define EL_SLAB_MAPPED (EL_SLAB_BYTES - EL_MAP_OFFSET)
+#define EL_SLAB_OF(cache, ptr) \
+  ((el_slab_t *) (((size_t) (ptr) & ~(EL_SLAB_BYTES - 1)) + (cache)->offset))
+
+// Offset of the first slot of a slab for objects of the given alignment
+static size_t el_slab_first(size_t align){
+  return (sizeof(el_slab_t) + align - 1) & ~(align - 1);
+}
+
+// Add a slab to the front of a list
+static void el_slab_push(el_slab_t **list, el_slab_t *slab){
+  slab->prev = NULL;
+  slab->next = *list;
+  if(*list != NULL){
+    (*list)->prev = slab;
+  }
+  *list = slab;
+}
+
+// Remove a slab from a list
+static void el_slab_unlink(el_slab_t **list, el_slab_t *slab){
+  if(slab->prev != NULL){
+    slab->prev->next = slab->next;
+  }
+  else{
+    *list = slab->next;
+  }
+  if(slab->next != NULL){
+    slab->next->prev = slab->prev;
+  }
+}
+
+// Return a new cache for objects of object_size bytes aligned to
+// align, which is rounded up to a pointer and must be a power of two.
+// Returns NULL if the alignment is not a power of two, fewer than
+// EL_SLAB_MIN_OBJECTS objects fit in a slab, or no space is available.
+el_slab_cache_t *el_slab_create(size_t object_size, size_t align){
+  size_t offset = (el_ctl->flags & EL_BUDDY) ? EL_MAP_OFFSET : 0;
+  size_t usable = offset ? EL_SLAB_MAPPED : EL_SLAB_USABLE;
+  if(align < sizeof(void *)){
+    align = sizeof(void *);
+  }
+  if((align & (align-1)) != 0 || align > EL_SLAB_BYTES / EL_SLAB_MIN_OBJECTS){
+    return NULL;
+  }
+  if(object_size < sizeof(void *)){
+    object_size = sizeof(void *);
+  }
+  if(object_size > EL_SLAB_BYTES){
+    return NULL;
+  }
+  size_t stride = (object_size + align - 1) & ~(align - 1);
+  size_t capacity = (usable - el_slab_first(align)) / stride;
+  if(capacity < EL_SLAB_MIN_OBJECTS){
+    return NULL;
+  }
+
+  el_slab_cache_t *cache = el_malloc(sizeof(el_slab_cache_t));
+  if(cache == NULL){
+    return NULL;
+  }
+  cache->object_size = object_size;
+  cache->align = align;
+  cache->stride = stride;
+  cache->capacity = capacity;
+  cache->offset = offset;
+  cache->partial = NULL;
+  cache->full = NULL;
+  cache->slab_count = 0;
+  return cache;
+}
+
+// Allocate a slab for the cache with every slot on its free list and
+// add it to the partial list. Returns NULL if no space is available.
+static el_slab_t *el_slab_grow(el_slab_cache_t *cache){
+  el_slab_t *slab = cache->offset ? el_map_malloc(EL_SLAB_MAPPED)
+                                  : el_aligned_alloc(EL_SLAB_BYTES, EL_SLAB_USABLE);
+  if(slab == NULL){
+    return NULL;
+  }
+  slab->used = 0;
+  slab->free = NULL;
+  void *slot = PTR_PLUS_BYTES(slab, el_slab_first(cache->align) + (cache->capacity-1)*cache->stride);
+  for(size_t i=0; i<cache->capacity; i++){  // lowest slot ends up first
+    *(void **) slot = slab->free;
+    slab->free = slot;
+    slot = PTR_MINUS_BYTES(slot, cache->stride);
+  }
+  el_slab_push(&cache->partial, slab);
+  cache->slab_count++;
+  return slab;
+}
+
+// Return a pointer to an object from the cache or NULL if no space is
+// available. Objects come from the first slab with a free slot; a new
+// slab is taken from the heap only when every slab is full.
+void *el_slab_alloc(el_slab_cache_t *cache){
+  el_slab_t *slab = cache->partial;
+  if(slab == NULL){
+    slab = el_slab_grow(cache);
+    if(slab == NULL){
+      return NULL;
+    }
+  }
+  void *ptr = slab->free;
+  slab->free = *(void **) ptr;
+  slab->used++;
+  if(slab->free == NULL){                   // now full
+    el_slab_unlink(&cache->partial, slab);
+    el_slab_push(&cache->full, slab);
+  }
+  return ptr;
+}
+
+// Return an object to its slab. A slab which becomes empty is freed
+// back to the heap unless it is the only slab with free slots, which
+// is kept so alternating alloc/free at a slab boundary does not churn
+// the heap. NULL is ignored.
+void el_slab_free(el_slab_cache_t *cache, void *ptr){
+  if(ptr == NULL){
+    return;
+  }
+  el_slab_t *slab = EL_SLAB_OF(cache, ptr);
+  if(slab->free == NULL){                   // was full
+    el_slab_unlink(&cache->full, slab);
+    el_slab_push(&cache->partial, slab);
+  }
+  *(void **) ptr = slab->free;
+  slab->free = ptr;
+  slab->used--;
+  if(slab->used == 0 && (slab->prev != NULL || slab->next != NULL)){
+    el_slab_unlink(&cache->partial, slab);
+    el_free(slab);
+    cache->slab_count--;
+  }
+}
+
+// Free every slab of the cache along with the cache itself
+void el_slab_destroy(el_slab_cache_t *cache){
+  el_slab_t *lists[2] = {cache->partial, cache->full};
+  for(int i=0; i<2; i++){
+    el_slab_t *slab = lists[i];
+    while(slab != NULL){
+      el_slab_t *next = slab->next;
+      el_free(slab);
+      slab = next;
+    }
+  }
+  el_free(cache);
+}
+
+// Print the cache's geometry and the occupancy of each of its slabs,
+// partial slabs first
+void el_slab_print_stats(el_slab_cache_t *cache){
+  printf("SLAB CACHE (object_size: %lu  stride: %lu  capacity: %lu  slabs: %lu)\n",
+         cache->object_size, cache->stride, cache->capacity, cache->slab_count);
+  el_slab_t *lists[2] = {cache->partial, cache->full};
+  int i = 0;
+  size_t used = 0;
+  for(int l=0; l<2; l++){
+    for(el_slab_t *slab = lists[l]; slab != NULL; slab = slab->next){
+      printf("[%3d] @ %p used: %3lu / %lu (%5.1f%%)\n", i, (void *) slab,
+             slab->used, cache->capacity, 100.0*slab->used/cache->capacity);
+      used += slab->used;
+      i++;
+    }
+  }
+  printf("objects: %lu  occupancy: %.1f%%\n", used,
+         cache->slab_count > 0 ? 100.0*used/(cache->slab_count*cache->capacity) : 0.0);
+}
@@ -5,6 +5,9 @@
 #include <assert.h>
 #include <stdlib.h>
 #include "el_malloc.h"
+#ifdef EL_THREADSAFE
+#include <pthread.h>
+#endif
 
 #define HEAP_SIZE 1024
 
@@ -27,6 +30,69 @@ void print_ptrs(void *ptr[], int len){
   }
 }
 
+#ifdef EL_THREADSAFE
+// Print the stats of arena i which need not be the arena of the
+// calling thread
+void print_arena(int i){
+  el_ctl_t *saved = el_ctl;
+  el_ctl = el_arena(i);
+  printf("ARENA %d\n",i); el_print_stats(); printf("\n");
+  el_ctl = saved;
+}
+
+// Return the index of the arena owning ptr
+int arena_index(void *ptr){
+  int i = 0;
+  while(el_arena(i) != el_arena_of(ptr)){
+    i++;
+  }
+  return i;
+}
+
+// Worker of "Arena Routing": allocates ptr[2] and ptr[3] from the
+// arena of a new thread, then frees ptr[0] of the main thread and its
+// own ptr[2]
+void *routing_worker(void *arg){
+  void **ptr = arg;
+  ptr[2] = el_malloc(1000);
+  ptr[3] = el_malloc(1000);
+  el_free(ptr[0]);
+  el_free(ptr[2]);
+  return NULL;
+}
+
+// Worker of "Remote Free": frees the blocks of the main thread in
+// the NULL-terminated array arg
+void *remote_worker(void *arg){
+  void **ptr = arg;
+  for(int i=0; ptr[i] != NULL; i++){
+    el_free(ptr[i]);
+  }
+  return NULL;
+}
+
+pthread_barrier_t tcache_barrier;
+
+// Worker of "Tcache Generation": fills its cache with 8 blocks, waits
+// twice at tcache_barrier while the main thread prints and creates
+// the arenas again, fills it again and waits twice more before it
+// exits
+void *tcache_worker(void *arg){
+  void *ptr[8];
+  for(int round=0; round<2; round++){
+    for(int i=0; i<8; i++){
+      ptr[i] = el_malloc(32);
+    }
+    for(int i=0; i<8; i++){
+      el_free(ptr[i]);
+    }
+    pthread_barrier_wait(&tcache_barrier);
+    pthread_barrier_wait(&tcache_barrier);
+  }
+  return NULL;
+}
+#endif
+
 // void run_test();
 
 int main(int argc, char *argv[]){
@@ -248,7 +314,9 @@ int main(int argc, char *argv[]){
     PRINT_TEST;
     // Allocates 4 times which each succeed. Then attempts to allocate
     // again for a large block which cannot be allocated. el_malloc()
-    // should return NULL in this case and the heap remains unchanged.
+    // should return NULL in this case and the heap remains unchanged
+    // as automatic heap growth is disabled.
+    el_ctl->grow_factor = 0;
 
     void *ptr[16] = {};
     int len = 0;
@@ -437,7 +505,9 @@ int main(int argc, char *argv[]){
   else if( strcmp( test_name, "Append Pages 3" )==0 ) {
     PRINT_TEST;
     // Tests if heap expansion allows a large-ish malloc that fails
-    // initially to succeed after expansion.
+    // initially to succeed after expansion. Automatic heap growth is
+    // disabled so that the first attempt fails.
+    el_ctl->grow_factor = 0;
     void *p1, *p2;
     p1 = el_malloc(EL_PAGE_BYTES/2); // succeeds
     p2 = el_malloc(EL_PAGE_BYTES);   // fails
@@ -485,6 +555,672 @@ int main(int argc, char *argv[]){
     el_print_stats(); printf("\n");
   } // ENDTEST
 
+  else if( strcmp( test_name, "Auto Grow" )==0 ) {
+    PRINT_TEST;
+    // Tests that el_malloc() grows the heap when no block is large
+    // enough. The first growth merges with the free block at the top
+    // of the heap and doubles the heap; the second finds the top
+    // block in use and maps only the pages needed.
+    void *ptr[16] = {};
+    int len = 0;
+
+    ptr[len++] = el_malloc(3000);
+    ptr[len++] = el_malloc(2000);
+    printf("\nMALLOC 0,1\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+    printf("grow_count: %lu\n",el_ctl->grow_count);
+
+    ptr[len++] = el_malloc(3048);
+    ptr[len++] = el_malloc(9000);
+    printf("\nMALLOC 2,3\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+    printf("grow_count: %lu\n",el_ctl->grow_count);
+
+    el_free(ptr[0]);
+    el_free(ptr[1]);
+    el_free(ptr[2]);
+    el_free(ptr[3]);
+    printf("\nFREE 0-3\n"); el_print_stats(); printf("\n");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Trim Heap" )==0 ) {
+    PRINT_TEST;
+    // Tests el_trim() and automatic trimming. A large block freed in
+    // the middle of the heap has its pages discarded by el_trim()
+    // while the free top block is unmapped. Freeing the last block
+    // leaves a top block over the trim threshold, which growing the
+    // heap for the large block raised, and el_free() trims it to half
+    // the threshold.
+    void *ptr[16] = {};
+    int len = 0;
+
+    ptr[len++] = el_malloc(100);
+    ptr[len++] = el_malloc(300000);
+    ptr[len++] = el_malloc(100);
+    el_free(ptr[1]);
+    printf("\nMALLOC 0-2, FREE 1\n"); el_print_stats(); printf("\n");
+
+    size_t released = el_trim(0);
+    printf("\nTRIM, released: %lu\n",released); el_print_stats(); printf("\n");
+
+    printf("trim_threshold: %lu\n",el_ctl->trim_threshold);
+    el_free(ptr[2]);
+    printf("\nFREE 2\n"); el_print_stats(); printf("\n");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Grow Interleaved" )==0 ) {
+    PRINT_TEST;
+    // Tests that automatic trimming does not undo geometric growth.
+    // Interleaving many small el_malloc() calls with el_free() of
+    // every tenth block leaves the free top block of each growth
+    // below the raised trim threshold, so the heap grows a
+    // logarithmic number of times and little is released.
+    for(int i=0; i<200000; i++){
+      void *ptr = el_malloc(64);
+      if(i % 10 == 0){
+        el_free(ptr);
+      }
+    }
+    printf("heap_bytes: %lu  grow_count: %lu  released_bytes: %lu\n",
+           el_ctl->heap_bytes, el_ctl->grow_count, el_ctl->released_bytes);
+    printf("trim_threshold: %lu\n",el_ctl->trim_threshold);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Realloc" )==0 ) {
+    PRINT_TEST;
+    // Tests el_realloc(). Growing into a free block above and
+    // shrinking both happen in place. Growing a block with a used
+    // block above moves it and copies its contents.
+    void *ptr[16] = {};
+    int len = 0;
+
+    ptr[len++] = el_malloc(100);
+    ptr[len++] = el_malloc(200);
+    ptr[len++] = el_malloc(100);
+    strcpy(ptr[0], "hello realloc");
+    el_free(ptr[1]); ptr[1] = NULL;
+    printf("\nMALLOC 0-2, FREE 1\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    ptr[0] = el_realloc(ptr[0], 250);
+    printf("\nREALLOC 0 GROW IN PLACE\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    ptr[0] = el_realloc(ptr[0], 40);
+    printf("\nREALLOC 0 SHRINK\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    ptr[0] = el_realloc(ptr[0], 500);
+    printf("\nREALLOC 0 MOVE\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+    printf("contents: %s\n",(char *) ptr[0]);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Calloc" )==0 ) {
+    PRINT_TEST;
+    // Tests el_calloc(). Blocks carved from never used memory are
+    // zero without clearing; reusing a freed block must clear the old
+    // contents. Overflowing element counts give NULL.
+    void *ptr[16] = {};
+    int len = 0;
+
+    ptr[len++] = el_calloc(10, 20);
+    memset(ptr[0], 0xff, 200);
+    printf("zero_start: %p\n",el_ctl->zero_start);
+    ptr[len++] = el_calloc(4, 25);
+    printf("zero_start: %p\n",el_ctl->zero_start);
+    el_free(ptr[0]);
+    ptr[0] = el_calloc(100, 2);
+    printf("zero_start: %p\n",el_ctl->zero_start);
+    ptr[len++] = el_calloc((size_t) 1 << 62, 8);
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    for(int i=0; i<2; i++){
+      int nonzero = 0;
+      for(int j=0; j<100; j++){
+        nonzero += ((char *) ptr[i])[j] != 0;
+      }
+      printf("ptr[%d] nonzero bytes: %d\n",i,nonzero);
+    }
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Aligned Alloc" )==0 ) {
+    PRINT_TEST;
+    // Tests el_aligned_alloc() and the rounding of el_malloc()
+    // sizes. Odd sizes still give 16-byte aligned pointers. Leading
+    // slack before a large alignment becomes an available block of
+    // its own rather than being wasted.
+    void *ptr[16] = {};
+    int len = 0;
+
+    ptr[len++] = el_malloc(22);
+    ptr[len++] = el_malloc(1);
+    ptr[len++] = el_aligned_alloc(256, 100);
+    ptr[len++] = el_aligned_alloc(8, 10);
+    ptr[len++] = el_aligned_alloc(48, 10);
+    printf("\nMALLOC 0-1, ALIGNED 2-4\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+    for(int i=0; i<len-1; i++){
+      printf("ptr[%d] %% 16: %lu  %% 256: %lu\n",i,
+             (size_t) ptr[i] % 16, (size_t) ptr[i] % 256);
+    }
+
+    el_free(ptr[2]); ptr[2] = NULL;
+    printf("\nFREE 2\n"); el_print_stats(); printf("\n");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Heap Handles" )==0 ) {
+    PRINT_TEST;
+    // Tests independent heaps from el_heap_create(). Their addresses
+    // are chosen by the kernel so offsets from heap_start are
+    // shown. Blocks come from the given heap only, heaps grow within
+    // their reservation, and the default heap is untouched.
+    el_heap_t *h1 = el_heap_create(1, 0);
+    el_heap_t *h2 = el_heap_create(3*EL_PAGE_BYTES, EL_SEGREGATED);
+    printf("h1 heap_bytes: %lu  h2 heap_bytes: %lu\n",h1->heap_bytes,h2->heap_bytes);
+    printf("distinct heaps: %d\n",h1->heap_start != h2->heap_start &&
+           h1->heap_start != el_ctl->heap_start);
+
+    void *a = el_heap_malloc(h1, 100);
+    void *b = el_heap_malloc(h2, 100);
+    void *c = el_heap_malloc(h1, 3*EL_PAGE_BYTES);
+    printf("a offset: %ld  b offset: %ld  c offset: %ld\n",
+           PTR_MINUS_PTR(a, h1->heap_start), PTR_MINUS_PTR(b, h2->heap_start),
+           PTR_MINUS_PTR(c, h1->heap_start));
+    printf("h1 used: %lu  heap_bytes: %lu  grow_count: %lu\n",
+           h1->used->length, h1->heap_bytes, h1->grow_count);
+    printf("h2 used: %lu  default used: %lu\n",h2->used->length,el_ctl->used->length);
+
+    el_heap_free(h1, c);
+    el_heap_free(h1, a);
+    el_heap_free(h2, b);
+    printf("h1 used: %lu  h2 used: %lu\n",h1->used->length,h2->used->length);
+    el_heap_destroy(h1);
+    el_heap_destroy(h2);
+
+    void *d = el_malloc(100);
+    printf("default heap offset: %ld\n",PTR_MINUS_PTR(d, el_ctl->heap_start));
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Region" )==0 ) {
+    PRINT_TEST;
+    // Tests regions from el_region_begin(). Objects are bumped off a
+    // chunk of the heap without headers, an object too large for the
+    // chunk gets a chunk of its own, and reset/end give every chunk
+    // back to the heap at once.
+    el_region_t *region = el_region_begin();
+    printf("used blocks: %lu  region offset: %ld\n",
+           el_ctl->used->length, PTR_MINUS_PTR(region, el_ctl->heap_start));
+
+    char *a = el_region_alloc(region, 10);
+    char *b = el_region_alloc(region, 40);
+    char *c = el_region_alloc(region, 1);
+    printf("b-a: %ld  c-b: %ld  c %% 16: %lu  bytes: %lu\n",
+           PTR_MINUS_PTR(b, a), PTR_MINUS_PTR(c, b), (size_t) c % 16, region->bytes);
+
+    char *big = el_region_alloc(region, 2*EL_REGION_CHUNK);
+    char *d = el_region_alloc(region, 100);
+    printf("used blocks: %lu  bytes: %lu  d-c: %ld  big %% 16: %lu\n",
+           el_ctl->used->length, region->bytes, PTR_MINUS_PTR(d, c), (size_t) big % 16);
+
+    el_region_reset(region);
+    char *e = el_region_alloc(region, 10);
+    printf("after reset used blocks: %lu  bytes: %lu  e==a: %d\n",
+           el_ctl->used->length, region->bytes, e == a);
+
+    el_region_end(region);
+    printf("after end used blocks: %lu\n",el_ctl->used->length);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Slab" )==0 ) {
+    PRINT_TEST;
+    // Tests slab caches from el_slab_create(). Objects are packed at
+    // the stride of the cache within page-aligned slabs, freed slots
+    // are reused first, and a slab left empty goes back to the heap
+    // unless it is the last one with free slots.
+    el_slab_cache_t *cache = el_slab_create(40, 16);
+    printf("bad align: %p  too big: %p\n",
+           (void *) el_slab_create(40, 24), (void *) el_slab_create(2*EL_PAGE_BYTES, 8));
+
+    void *objs[100] = {};
+    for(int i=0; i<100; i++){
+      objs[i] = el_slab_alloc(cache);
+    }
+    printf("objs[1]-objs[0]: %ld  objs[0] %% 16: %lu  slab gap: %ld\n",
+           PTR_MINUS_PTR(objs[1], objs[0]), (size_t) objs[0] % 16,
+           PTR_MINUS_PTR(objs[cache->capacity], objs[0]));
+    printf("\nALLOC 0-99\n"); el_slab_print_stats(cache); printf("\n");
+
+    el_slab_free(cache, objs[5]);
+    void *again = el_slab_alloc(cache);
+    printf("reused slot: %d\n",again == objs[5]);
+    for(int i=0; i<(int) cache->capacity; i++){
+      el_slab_free(cache, objs[i]);
+    }
+    printf("\nFREE FIRST SLAB\n"); el_slab_print_stats(cache); printf("\n");
+    printf("heap used blocks: %lu\n",el_ctl->used->length);
+
+    for(int i=cache->capacity; i<100; i++){
+      el_slab_free(cache, objs[i]);
+    }
+    printf("\nFREE ALL\n"); el_slab_print_stats(cache); printf("\n");
+    el_slab_destroy(cache);
+    printf("heap used blocks: %lu\n",el_ctl->used->length);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Slab Buddy" )==0 ) {
+    PRINT_TEST;
+    // Tests slab caches on an EL_BUDDY heap which cannot place a block
+    // on a page boundary. Each slab is instead a page mapped for it
+    // alone, so the mappings track the slabs, objects sit just past the
+    // header of their mapping, and an empty slab is unmapped.
+    el_cleanup();
+    el_init_flags(EL_BUDDY);
+    el_slab_cache_t *cache = el_slab_create(40, 16);
+    printf("capacity: %lu  offset: %lu\n",cache->capacity,cache->offset);
+
+    void *objs[200] = {};
+    for(int i=0; i<200; i++){
+      objs[i] = el_slab_alloc(cache);
+    }
+    printf("objs[1]-objs[0]: %ld  first slot in page: %lu\n",
+           PTR_MINUS_PTR(objs[1], objs[0]), (size_t) objs[0] % EL_SLAB_BYTES);
+    printf("slabs: %lu  mapped_count: %lu  mapped_bytes: %lu\n",
+           cache->slab_count, el_ctl->mapped_count, el_ctl->mapped_bytes);
+
+    el_slab_free(cache, objs[150]);
+    void *again = el_slab_alloc(cache);
+    printf("reused slot: %d\n",again == objs[150]);
+
+    for(int i=0; i<200; i++){
+      el_slab_free(cache, objs[i]);
+    }
+    printf("FREE ALL slabs: %lu  mapped_count: %lu\n",
+           cache->slab_count, el_ctl->mapped_count);
+    el_slab_destroy(cache);
+    printf("DESTROY mapped_count: %lu  mapped_bytes: %lu\n",
+           el_ctl->mapped_count, el_ctl->mapped_bytes);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Large Blocks" )==0 ) {
+    PRINT_TEST;
+    // Tests blocks of at least mmap_threshold bytes which get their
+    // own mapping outside the heap. Their addresses are chosen by the
+    // kernel so only their alignment is shown. Growing one with
+    // el_realloc() keeps its contents, freeing it unmaps it, and one
+    // shrinking below the threshold moves back into the heap.
+    void *small = el_malloc(100);
+    char *big = el_malloc(2*EL_MMAP_THRESHOLD);
+    char *zero = el_calloc(EL_MMAP_THRESHOLD, 1);
+    printf("big %% 16: %lu  outside heap: %d  zero[100]: %d\n",(size_t) big % 16,
+           (void *) big >= el_ctl->heap_end || (void *) big < el_ctl->heap_start, zero[100]);
+    printf("\nMALLOC LARGE\n"); el_print_stats(); printf("\n");
+
+    strcpy(big, "large contents");
+    big[2*EL_MMAP_THRESHOLD-1] = 'z';
+    big = el_realloc(big, 8*EL_MMAP_THRESHOLD);
+    printf("grown: %s %c  mapped bytes: %lu\n",big,big[2*EL_MMAP_THRESHOLD-1],el_ctl->mapped_bytes);
+
+    el_free(zero);
+    big = el_realloc(big, 200);
+    printf("shrunk: %s  in heap: %d\n",big,
+           (void *) big >= el_ctl->heap_start && (void *) big < el_ctl->heap_end);
+    printf("\nFREE/SHRINK LARGE\n"); el_print_stats(); printf("\n");
+
+    el_ctl->mmap_threshold = 0;
+    void *heaped = el_malloc(2*EL_MMAP_THRESHOLD);
+    printf("threshold 0 in heap: %d  mapped: %lu\n",
+           heaped >= el_ctl->heap_start && heaped < el_ctl->heap_end, el_ctl->mapped_count);
+    el_free(small);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Buddy" )==0 ) {
+    PRINT_TEST;
+    // Tests the EL_BUDDY engine. Requests are rounded up to power of
+    // two blocks split from larger ones, freeing merges a block with
+    // its buddy only once both halves are free, and growing the heap
+    // adds blocks that merge with the old ones.
+    el_cleanup();
+    el_init_flags(EL_BUDDY);
+    printf("\nINIT\n"); el_print_stats(); printf("\n");
+
+    void *ptr[16] = {};
+    int len = 0;
+
+    ptr[len++] = el_malloc(100);
+    ptr[len++] = el_malloc(20);
+    ptr[len++] = el_malloc(200);
+    ptr[len++] = el_malloc(24);
+    printf("\nMALLOC 0-3\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    el_free(ptr[1]);
+    el_free(ptr[2]);
+    printf("\nFREE 1,2\n"); el_print_stats(); printf("\n");
+
+    ptr[len++] = el_malloc(3000);
+    printf("\nMALLOC 4\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    el_free(ptr[0]);
+    el_free(ptr[3]);
+    el_free(ptr[4]);
+    printf("\nFREE 0,3,4\n"); el_print_stats(); printf("\n");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Best Fit" )==0 ) {
+    PRINT_TEST;
+    // Tests that EL_BEST_FIT keeps available blocks in a balanced tree
+    // by size and address and that el_malloc() takes the smallest
+    // block that fits rather than the first one.
+    el_cleanup();
+    el_init_flags(EL_BEST_FIT);
+
+    void *ptr[16] = {};
+    int len = 0;
+    size_t sizes[6] = {400, 100, 200, 100, 300, 150};
+    for(int i=0; i<6; i++){
+      ptr[len++] = el_malloc(sizes[i]);
+      el_malloc(8);                             // spacer
+    }
+    for(int i=0; i<6; i++){
+      el_free(ptr[i]);
+    }
+    printf("\nFREE 0-5\n"); el_print_stats(); printf("\n");
+
+    ptr[len++] = el_malloc(180);
+    ptr[len++] = el_malloc(100);
+    printf("\nMALLOC 6-7\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Address Order" )==0 ) {
+    PRINT_TEST;
+    // Tests that EL_ADDRESS_ORDER keeps available blocks in a tree by
+    // address whatever order they are freed in so that el_malloc()
+    // takes the lowest block that fits and the top of the heap stays
+    // free.
+    el_cleanup();
+    el_init_flags(EL_ADDRESS_ORDER);
+
+    void *ptr[16] = {};
+    int len = 0;
+    for(int i=0; i<6; i++){
+      ptr[len++] = el_malloc(200);
+      el_malloc(8);                             // spacer
+    }
+    int order[6] = {4, 1, 5, 0, 3, 2};
+    for(int i=0; i<6; i++){
+      el_free(ptr[order[i]]);
+    }
+    printf("\nFREE 4,1,5,0,3,2\n"); el_print_stats(); printf("\n");
+
+    ptr[len++] = el_malloc(150);
+    ptr[len++] = el_malloc(100);
+    ptr[len++] = el_malloc(200);
+    printf("\nMALLOC 6-8\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Address Order Search" )==0 ) {
+    PRINT_TEST;
+    // Tests that the search of EL_ADDRESS_ORDER passes over subtrees
+    // whose blocks are all too small even when they are within a
+    // factor of two of the request. 1000 available blocks of 208 bytes
+    // lie below the top block; a request for 224 bytes takes the top
+    // block after examining a handful of nodes, not all of them.
+    el_cleanup();
+    el_init_flags(EL_ADDRESS_ORDER);
+
+    void *ptr[1000];
+    for(int i=0; i<1000; i++){
+      ptr[i] = el_malloc(200);
+      el_malloc(8);                             // spacer
+    }
+    for(int i=0; i<1000; i++){
+      el_free(ptr[i]);
+    }
+    printf("available blocks: %lu\n",el_ctl->avail->length);
+
+    size_t steps = el_ctl->search_steps;
+    void *big = el_malloc(224);
+    printf("steps: %lu  above the freed blocks: %d\n",el_ctl->search_steps - steps,
+           big > ptr[999]);
+
+    steps = el_ctl->search_steps;
+    void *small = el_malloc(200);
+    printf("steps: %lu  lowest block: %d\n",el_ctl->search_steps - steps, small == ptr[0]);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Next Fit" )==0 ) {
+    PRINT_TEST;
+    // Tests that EL_NEXT_FIT resumes each search of the available list
+    // from the rover left by the last one rather than its front, and
+    // that the rover moves on when the block it points at is taken.
+    el_cleanup();
+    el_init_flags(EL_NEXT_FIT);
+
+    void *ptr[16] = {};
+    int len = 0;
+    for(int i=0; i<4; i++){
+      ptr[len++] = el_malloc(200);
+      el_malloc(8);                             // spacer
+    }
+    for(int i=0; i<4; i++){
+      el_free(ptr[i]);
+    }
+    printf("\nFREE 0-3\n"); el_print_stats(); printf("\n");
+
+    ptr[len++] = el_malloc(64);
+    ptr[len++] = el_malloc(64);
+    ptr[len++] = el_malloc(300);
+    ptr[len++] = el_malloc(64);
+    printf("\nMALLOC 4-7\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Deferred Coalescing" )==0 ) {
+    PRINT_TEST;
+    // Tests that EL_DEFERRED parks freed blocks on quick lists without
+    // merging, reuses them for requests of the same size, and coalesces
+    // them when an allocation misses or the threshold is crossed.
+    el_cleanup();
+    el_init_flags(EL_DEFERRED);
+
+    void *ptr[16] = {};
+    int len = 0;
+    for(int i=0; i<4; i++){
+      ptr[len++] = el_malloc(400);
+    }
+    el_free(ptr[1]);
+    el_free(ptr[2]);
+    printf("\nFREE 1,2\n"); el_print_stats(); printf("\n");
+
+    ptr[len++] = el_malloc(400);
+    el_free(ptr[0]);
+    el_free(ptr[3]);
+    el_free(ptr[4]);
+    ptr[len++] = el_malloc(3000);               // misses so coalesces
+    printf("\nMALLOC 4, FREE 0,3,4, MALLOC 5\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    el_ctl->quick_threshold = 1;
+    ptr[len++] = el_malloc(100);
+    ptr[len++] = el_malloc(100);
+    el_free(ptr[6]);
+    el_free(ptr[7]);                            // crosses the threshold
+    printf("\nMALLOC 6-7, FREE 6,7\n"); el_print_stats(); printf("\n");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Trace" )==0 ) {
+    PRINT_TEST;
+    // Tests that el_trace_begin() records each successful call with
+    // pointer IDs that survive el_realloc(), even one that fails, and
+    // skips failed calls, NULL frees, and blocks allocated before the
+    // trace began.
+    el_cleanup();
+    el_init_flags(0);
+
+    void *ptr[16] = {};
+    int len = 0;
+    ptr[len++] = el_malloc(100);                // before the trace
+    el_trace_begin("test-trace.bin");
+    ptr[len++] = el_malloc(200);
+    ptr[len++] = el_calloc(10, 30);
+    ptr[len++] = el_aligned_alloc(256, 64);
+    ptr[len++] = el_aligned_alloc(3, 64);       // fails
+    ptr[1] = el_realloc(ptr[1], 2000);
+    el_calloc(SIZE_MAX/2, 4);                   // overflows
+    el_realloc(ptr[1], SIZE_MAX/2);             // fails
+    ptr[1] = el_realloc(ptr[1], 3000);
+    el_append_pages_to_heap(2);
+    el_free(ptr[0]);                            // not traced
+    el_free(ptr[2]);
+    el_free(NULL);
+    ptr[3] = el_realloc(ptr[3], 0);
+    ptr[len++] = el_malloc(200);
+    el_trace_end();
+    el_free(ptr[1]);                            // after the trace
+
+    FILE *file = fopen("test-trace.bin", "rb");
+    el_trace_head_t head;
+    el_trace_rec_t rec;
+    fread(&head, sizeof(head), 1, file);
+    printf("magic: %.8s  flags: %lu\n", head.magic, head.flags);
+    while(fread(&rec, sizeof(rec), 1, file) == 1){
+      printf("op: %c  id: %u  size: %4lu  align_log2: %u\n",
+             rec.op, rec.id, rec.size, rec.align_log2);
+    }
+    fclose(file);
+    remove("test-trace.bin");
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Trim Short Top" )==0 ) {
+    PRINT_TEST;
+    // Tests that el_trim(0) leaves a top block ending just short of a
+    // page boundary at least EL_MIN_SIZE so its links and footer stay
+    // inside the heap. Run with test_el_malloc_compact where the
+    // smallest block would otherwise not fit them.
+    el_cleanup();
+    el_init();
+    el_append_pages_to_heap(2);
+    // the top block starts 24 bytes short of the first page boundary
+    void *ptr = el_malloc(EL_PAGE_BYTES - 24 - EL_HEAP_PAD - EL_BLOCK_OVERHEAD);
+    printf("\nMALLOC\n"); el_print_stats(); printf("\n");
+    size_t released = el_trim(0);
+    printf("released: %lu\n", released);
+    printf("\nTRIM 0\n"); el_print_stats(); printf("\n");
+    el_free(ptr);
+    printf("\nFREE\n"); el_print_stats(); printf("\n");
+  } // ENDTEST
+
+#ifdef EL_THREADSAFE
+  else if( strcmp( test_name, "Arena Routing" )==0 ) {
+    PRINT_TEST;
+    // Tests that each thread allocates from an arena of its own and
+    // that el_free() routes a block to the arena owning it. The main
+    // thread has arena 0 and the worker arena 1. The block of the main
+    // thread freed by the worker waits on the remote free stack of
+    // arena 0 until the main thread next allocates; the block the main
+    // thread frees for the exited worker waits on that of arena 1.
+    void *ptr[5] = {};
+    ptr[0] = el_malloc(1000);
+    ptr[1] = el_malloc(1000);
+    pthread_t thread;
+    pthread_create(&thread, NULL, routing_worker, ptr);
+    pthread_join(thread, NULL);
+    for(int i=0; i<4; i++){
+      printf("ptr[%d] arena: %d\n",i,arena_index(ptr[i]));
+    }
+
+    el_free(ptr[3]);
+    printf("\nFREE ACROSS THREADS\n"); print_arena(0); print_arena(1);
+
+    ptr[4] = el_malloc(1000);
+    printf("\nMALLOC 4\n"); print_arena(0); print_arena(1);
+    printf("ptr[4] == ptr[0]: %d\n",ptr[4] == ptr[0]);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Tcache Generation" )==0 ) {
+    PRINT_TEST;
+    // Tests that a thread cache made before the arenas are created
+    // again hands out none of its blocks and that a thread's cache
+    // is flushed to its arena when it exits. Cached blocks stay used
+    // in arena 1 of the worker. After el_cleanup() and
+    // el_init_flags() its next el_malloc() calls all miss and take
+    // new blocks from the new arena; when it exits they all become
+    // available again.
+    pthread_barrier_init(&tcache_barrier, NULL, 2);
+    pthread_t thread;
+    pthread_create(&thread, NULL, tcache_worker, NULL);
+    pthread_barrier_wait(&tcache_barrier);
+    printf("\nWORKER CACHE FILLED\n"); print_arena(1);
+
+    el_cleanup();
+    el_init_flags(0);
+    pthread_barrier_wait(&tcache_barrier);
+    pthread_barrier_wait(&tcache_barrier);
+    printf("\nNEW ARENAS, WORKER CACHE FILLED\n"); print_arena(1);
+
+    pthread_barrier_wait(&tcache_barrier);
+    pthread_join(thread, NULL);
+    printf("\nWORKER EXITED\n"); print_arena(1);
+    pthread_barrier_destroy(&tcache_barrier);
+  } // ENDTEST
+
+  else if( strcmp( test_name, "Remote Free" )==0 ) {
+    PRINT_TEST;
+    // Tests the remote free stack. The main thread allocates four
+    // blocks from arena 0 which a worker frees; they stay used on the
+    // stack of arena 0 until the main thread next calls el_malloc(),
+    // which drains the stack and coalesces the blocks into one
+    // available block that the new request is split from.
+    void *ptr[6] = {};
+    for(int i=0; i<4; i++){
+      ptr[i] = el_malloc(200);
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, remote_worker, ptr);
+    pthread_join(thread, NULL);
+    printf("\nWORKER FREED 0-3\n"); print_arena(0);
+
+    ptr[4] = el_malloc(100);
+    printf("\nMALLOC 4\n"); print_arena(0);
+    printf("ptr[4] == ptr[0]: %d\n",ptr[4] == ptr[0]);
+  } // ENDTEST
+#endif
+
+  else if( strcmp( test_name, "Segregated Bins" )==0 ) {
+    PRINT_TEST;
+    // Tests that EL_SEGREGATED places available blocks in size-class
+    // bins and that splitting/merging moves blocks between bins.
+    el_cleanup();
+    el_init_flags(EL_SEGREGATED);
+
+    void *ptr[16] = {};
+    int len = 0;
+
+    ptr[len++] = el_malloc(128);
+    ptr[len++] = el_malloc(40);
+    ptr[len++] = el_malloc(512);
+    ptr[len++] = el_malloc(16);
+    printf("\nMALLOC 0-3\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    el_free(ptr[0]);
+    el_free(ptr[2]);
+    printf("\nFREE 0,2\n"); el_print_stats(); printf("\n");
+
+    ptr[len++] = el_malloc(100);
+    printf("\nMALLOC 4\n"); el_print_stats(); printf("\n");
+    printf("POINTERS\n"); print_ptrs(ptr, len);
+
+    el_free(ptr[1]);
+    el_free(ptr[3]);
+    el_free(ptr[4]);
+    printf("\nFREE 1,3,4\n"); el_print_stats(); printf("\n");
+  } // ENDTEST
+
   else{
     printf("No test named '%s' found\n",test_name);
     return 1;